@@ -0,0 +1,341 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+/*
+Loopback benchmark: an in-process MonaSRT receives synthetic H264 TS streams from local SRT callers (SRTIn),
+demuxes them into publications, then muxes them again for local SRT receivers pulling them through the
+SRT listener output (SRTServer, same TSMux and SRTSender path as OutputApp).
+Every step raises the bitrate, the report gives per step the throughput, the frames lost, CPU per Mbps,
+heap allocations per second and end-to-end latency percentiles, then the maximum sustainable bitrate.
+
+Usage: MonaSRTBench [--bitrate=5] [--streams=1] [--steps=5] [--duration=10] [--fps=25] [--gop=50] [--port=14900]
+	[--maxLoss=0.01] [--maxLatency=500]
+	bitrate in Mbps by stream for the first step (step N sends N times more), duration in seconds by step,
+	maxLoss is the ratio of frames lost and maxLatency the p99 latency in ms above which a step is not sustainable
+*/
+
+#include "MonaSRT.h"
+#include "SRTRuntime.h"
+#include "Histogram.h"
+#include "Mona/TSWriter.h"
+#include <sys/resource.h>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace Mona;
+using namespace std;
+
+// Heap allocations of the whole process
+static atomic<UInt64> Allocations(0);
+void* operator new(size_t size) {
+	++Allocations;
+	if (void* pData = malloc(size ? size : 1))
+		return pData;
+	throw bad_alloc();
+}
+void operator delete(void* pData) noexcept { free(pData); }
+void operator delete(void* pData, size_t) noexcept { free(pData); }
+
+static Int64 Now() { return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count(); }
+
+// Frame marker followed by its sending time, searched in the received TS
+static const char Marker[] = "MonaSRTBench";
+static const UInt32 MarkerSize = sizeof(Marker) - 1;
+
+struct BenchOptions {
+	BenchOptions() : bitrate(5), streams(1), steps(5), duration(10), fps(25), gop(50), port(14900), maxLoss(0.01), maxLatency(500) {}
+
+	bool parse(int argc, const char* argv[]) {
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			const char* value = strchr(arg, '=');
+			if (strncmp(arg, "--", 2) != 0 || !value) {
+				fprintf(stderr, "Invalid argument %s\n", arg);
+				return false;
+			}
+			string name(arg + 2, value++ - arg - 2);
+			if (name == "bitrate")
+				bitrate = atof(value);
+			else if (name == "streams")
+				streams = max(1, atoi(value));
+			else if (name == "steps")
+				steps = max(1, atoi(value));
+			else if (name == "duration")
+				duration = max(1, atoi(value));
+			else if (name == "fps")
+				fps = max(1, atoi(value));
+			else if (name == "gop")
+				gop = max(1, atoi(value));
+			else if (name == "port")
+				port = atoi(value);
+			else if (name == "maxLoss")
+				maxLoss = atof(value);
+			else if (name == "maxLatency")
+				maxLatency = atoi(value);
+			else {
+				fprintf(stderr, "Unknown option %s\n", name.c_str());
+				return false;
+			}
+		}
+		return true;
+	}
+
+	double	bitrate; // Mbps by stream
+	int		streams;
+	int		steps;
+	int		duration; // seconds by step
+	int		fps;
+	int		gop; // frames
+	int		port; // SRTIn port, the SRT listener output uses port + 1
+	double	maxLoss;
+	int		maxLatency; // ms
+};
+
+struct Counters {
+	Counters() : frames(0), bytes(0), received(0), receivedBytes(0) {}
+	void reset() { frames = bytes = received = receivedBytes = 0; latency.reset(); }
+
+	atomic<UInt64>	frames; // frames sent
+	atomic<UInt64>	bytes; // TS bytes sent
+	atomic<UInt64>	received; // frames received (marker found)
+	atomic<UInt64>	receivedBytes;
+	Histogram		latency; // us
+};
+
+static ::SRTSOCKET Connect(UInt16 port, const string& streamId) {
+	::SRTSOCKET socket = ::srt_socket(AF_INET, SOCK_DGRAM, 0);
+	if (socket == ::SRT_INVALID_SOCK)
+		return socket;
+	int timeout = 100;
+	::srt_setsockflag(socket, SRTO_STREAMID, streamId.data(), (int)streamId.size());
+	::srt_setsockflag(socket, SRTO_RCVTIMEO, &timeout, sizeof(timeout));
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (::srt_connect(socket, (sockaddr*)&address, sizeof(address)) < 0) {
+		fprintf(stderr, "SRT connect to %u: %s\n", port, ::srt_getlasterror_str());
+		::srt_close(socket);
+		return ::SRT_INVALID_SOCK;
+	}
+	return socket;
+}
+
+/*!
+Synthetic H264 stream muxed with TSWriter and sent by a SRT caller at the requested bitrate */
+struct Generator : private Thread {
+	Generator(const BenchOptions& options, UInt16 index, Counters& counters, const atomic<double>& bitrate) : Thread("BenchGenerator"),
+		_options(options), _streamId("bench" + to_string(index)), _counters(counters), _bitrate(bitrate), _socket(::SRT_INVALID_SOCK) {}
+	~Generator() { stop(); }
+
+	bool start() { return Thread::start(); }
+	void stop() { Thread::stop(); }
+
+private:
+	bool run(Exception& ex, const volatile bool& requestStop) {
+		if ((_socket = Connect(_options.port, _streamId)) == ::SRT_INVALID_SOCK)
+			return false;
+
+		TSWriter::OnWrite onWrite([this](const Packet& packet) { write(packet); });
+		_tsWriter.beginMedia(onWrite);
+
+		// Baseline profile config (AVCDecoderConfigurationRecord with one SPS and one PPS)
+		static const UInt8 Config[] = { 0x01, 0x42, 0x00, 0x1E, 0xFF, 0xE1, 0x00, 0x09, 0x67, 0x42, 0x00, 0x1E, 0x95, 0xA8, 0x28, 0x0F, 0x64, 0x01, 0x00, 0x04, 0x68, 0xCE, 0x3C, 0x80 };
+		Media::Video::Tag tag(Media::Video::CODEC_H264);
+		tag.frame = Media::Video::FRAME_CONFIG;
+		_tsWriter.writeVideo(0, tag, Packet(Config, sizeof(Config)), onWrite);
+
+		vector<UInt8> frame;
+		Int64 start = Now();
+		for (UInt32 index = 0; !requestStop; ++index) {
+			// Wait the frame time
+			Int64 time = start + Int64(index) * 1000000000 / _options.fps;
+			Int64 delay = (time - Now()) / 1000000;
+			if (delay > 0)
+				Sleep((UInt32)delay);
+
+			// One NAL unit: size, header, marker, sending time, then filler without start code emulation
+			UInt32 size = max<UInt32>(32, UInt32(_bitrate.load() * 1000000 / 8 / _options.fps));
+			frame.assign(size, 0xAA);
+			UInt32 nalSize = size - 4;
+			frame[0] = nalSize >> 24; frame[1] = nalSize >> 16; frame[2] = nalSize >> 8; frame[3] = nalSize & 0xFF;
+			bool key = (index % _options.gop) == 0;
+			frame[4] = key ? 0x65 : 0x41;
+			memcpy(&frame[5], Marker, MarkerSize);
+			Int64 now = Now();
+			memcpy(&frame[5 + MarkerSize], &now, sizeof(now));
+
+			tag.frame = key ? Media::Video::FRAME_KEY : Media::Video::FRAME_INTER;
+			tag.time = UInt32(Int64(index) * 1000 / _options.fps);
+			_tsWriter.writeVideo(0, tag, Packet(frame.data(), frame.size()), onWrite);
+			flush();
+			++_counters.frames;
+		}
+		::srt_close(_socket);
+		return true;
+	}
+
+	void write(const Packet& packet) {
+		const UInt8* data = packet.data();
+		UInt32 size = packet.size();
+		while (size) {
+			UInt32 copied = min<UInt32>(size, sizeof(_payload) - _size);
+			memcpy(_payload + _size, data, copied);
+			_size += copied;
+			data += copied;
+			size -= copied;
+			if (_size == sizeof(_payload))
+				flush();
+		}
+	}
+	void flush() {
+		if (!_size)
+			return;
+		if (::srt_sendmsg(_socket, (const char*)_payload, _size, -1, true) > 0)
+			_counters.bytes += _size;
+		_size = 0;
+	}
+
+	const BenchOptions&				_options;
+	const string				_streamId;
+	Counters&					_counters;
+	const atomic<double>&		_bitrate;
+	::SRTSOCKET					_socket;
+	TSWriter					_tsWriter;
+	UInt8						_payload[1316];
+	UInt32						_size = 0;
+};
+
+/*!
+SRT caller pulling a publication from the SRT listener output */
+struct Receiver : private Thread {
+	Receiver(const BenchOptions& options, UInt16 index, Counters& counters) : Thread("BenchReceiver"),
+		_options(options), _streamId("bench" + to_string(index)), _counters(counters) {}
+	~Receiver() { stop(); }
+
+	bool start() { return Thread::start(); }
+	void stop() { Thread::stop(); }
+
+private:
+	bool run(Exception& ex, const volatile bool& requestStop) {
+		::SRTSOCKET socket = Connect(_options.port + 1, _streamId);
+		if (socket == ::SRT_INVALID_SOCK)
+			return false;
+		char message[1500];
+		while (!requestStop) {
+			int size = ::srt_recvmsg(socket, message, sizeof(message));
+			if (size < 0) {
+				if (::srt_getlasterror(NULL) == SRT_EASYNCRCV)
+					continue; // timeout
+				fprintf(stderr, "SRT receiver %s: %s\n", _streamId.c_str(), ::srt_getlasterror_str());
+				break;
+			}
+			_counters.receivedBytes += size;
+			// Markers split between two TS packets are not found, the frames count is a lower bound
+			const char* end = message + size;
+			for (const char* cur = message; (cur = (const char*)memchr(cur, Marker[0], end - cur)); ++cur) {
+				if ((end - cur) < Int64(MarkerSize + sizeof(Int64)) || memcmp(cur, Marker, MarkerSize) != 0)
+					continue;
+				Int64 time;
+				memcpy(&time, cur + MarkerSize, sizeof(time));
+				_counters.latency.record(UInt64(max<Int64>(0, Now() - time)) / 1000);
+				++_counters.received;
+			}
+		}
+		::srt_close(socket);
+		return true;
+	}
+
+	const BenchOptions&	_options;
+	const string	_streamId;
+	Counters&		_counters;
+};
+
+static double CPUTime() {
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, const char* argv[]) {
+	BenchOptions options;
+	if (!options.parse(argc, argv))
+		return 1;
+
+	// In-process server: SRTIn on port, SRT listener output on port + 1
+	Parameters parameters;
+	parameters.setBoolean("HTTP", false);
+	parameters.setBoolean("HTTPS", false);
+	parameters.setBoolean("RTMFP", false);
+	parameters.setBoolean("RTMP", false);
+	parameters.setBoolean("SRT", true);
+	parameters.setString("srt.host", "127.0.0.1:" + to_string(options.port));
+	parameters.setString("srt.listen", "127.0.0.1:" + to_string(options.port + 1));
+	parameters.setBoolean("srt.statsExport", false);
+	TerminateSignal terminateSignal;
+	MonaSRT server("www", thread::hardware_concurrency(), terminateSignal);
+	server.start(parameters);
+	this_thread::sleep_for(chrono::milliseconds(500));
+
+	Counters counters;
+	atomic<double> bitrate(options.bitrate);
+	vector<unique<Generator>> generators;
+	vector<unique<Receiver>> receivers;
+	for (int i = 0; i < options.streams; ++i) {
+		generators.emplace_back(new Generator(options, i, counters, bitrate));
+		generators.back()->start();
+	}
+	// Publications exist now, start to pull them
+	this_thread::sleep_for(chrono::seconds(1));
+	for (int i = 0; i < options.streams; ++i) {
+		receivers.emplace_back(new Receiver(options, i, counters));
+		receivers.back()->start();
+	}
+	this_thread::sleep_for(chrono::seconds(1)); // warm-up
+
+	printf("%d stream(s), %d fps, GOP of %d frames, %ds by step\n", options.streams, options.fps, options.gop, options.duration);
+	printf("%10s %10s %10s %8s %10s %12s %8s %8s %8s %8s\n", "Mbps", "sent", "received", "lost", "CPU%", "CPU%/Mbps", "allocs/s", "p50 ms", "p99 ms", "p99.9 ms");
+	double sustainable = 0;
+	for (int step = 1; step <= options.steps; ++step) {
+		bitrate = options.bitrate * step;
+		this_thread::sleep_for(chrono::seconds(1)); // new bitrate settled
+		counters.reset();
+		UInt64 allocations = Allocations;
+		double cpu = CPUTime();
+		Int64 start = Now();
+
+		this_thread::sleep_for(chrono::seconds(options.duration));
+
+		double elapsed = (Now() - start) / 1e9;
+		cpu = (CPUTime() - cpu) / elapsed * 100;
+		double sent = counters.bytes * 8 / elapsed / 1e6;
+		double received = counters.receivedBytes * 8 / elapsed / 1e6;
+		double lost = counters.frames ? max(0.0, 1 - double(counters.received) / counters.frames) : 1;
+		double p99 = counters.latency.percentile(0.99) / 1000.0;
+		printf("%10.1f %10.1f %10.1f %7.2f%% %10.1f %12.2f %8.0f %8.1f %8.1f %8.1f\n", bitrate.load() * options.streams, sent, received, lost * 100, cpu,
+			sent ? cpu / sent : 0, (Allocations - allocations) / elapsed, counters.latency.percentile(0.5) / 1000.0, p99, counters.latency.percentile(0.999) / 1000.0);
+		if (lost > options.maxLoss || p99 > options.maxLatency)
+			break;
+		sustainable = sent;
+	}
+	printf("Max sustainable: %.1f Mbps\n", sustainable);
+
+	receivers.clear();
+	generators.clear();
+	server.stop();
+	return 0;
+}
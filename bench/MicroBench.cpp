@@ -0,0 +1,278 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+/*
+Microbenchmark of the TS hot paths without any socket:
+- mux: TSWriter packed into SRT payloads by TSPacker, as done by TSMux on its worker thread for OutputApp and SRTServer
+- demux: TSReader::read of SRT payloads into a media source, as done by SRTIn for every received payload
+Inputs are synthetic H264 and AAC frames, or the frames of a recorded TS file (--input=file.ts).
+For every path the report gives ns/frame, bytes copied by frame and heap allocations by frame.
+
+Usage: MonaSRTMicroBench [--input=file.ts] [--frames=10000] [--runs=5] [--bitrate=5] [--fps=25] [--gop=50]
+	bitrate in Mbps of the synthetic video, the best run is reported
+*/
+
+#include "TSPacker.h"
+#include "Mona/TSReader.h"
+#include "Mona/TSWriter.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace Mona;
+using namespace std;
+
+// Heap allocations of the whole process
+static atomic<UInt64> Allocations(0);
+void* operator new(size_t size) {
+	++Allocations;
+	if (void* pData = malloc(size ? size : 1))
+		return pData;
+	throw bad_alloc();
+}
+void operator delete(void* pData) noexcept { free(pData); }
+void operator delete(void* pData, size_t) noexcept { free(pData); }
+
+static Int64 Now() { return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count(); }
+
+struct BenchOptions {
+	BenchOptions() : frames(10000), runs(5), bitrate(5), fps(25), gop(50) {}
+
+	bool parse(int argc, const char* argv[]) {
+		for (int i = 1; i < argc; ++i) {
+			const char* arg = argv[i];
+			const char* value = strchr(arg, '=');
+			if (strncmp(arg, "--", 2) != 0 || !value) {
+				fprintf(stderr, "Invalid argument %s\n", arg);
+				return false;
+			}
+			string name(arg + 2, value++ - arg - 2);
+			if (name == "input")
+				input.assign(value);
+			else if (name == "frames")
+				frames = max(1, atoi(value));
+			else if (name == "runs")
+				runs = max(1, atoi(value));
+			else if (name == "bitrate")
+				bitrate = atof(value);
+			else if (name == "fps")
+				fps = max(1, atoi(value));
+			else if (name == "gop")
+				gop = max(1, atoi(value));
+			else {
+				fprintf(stderr, "Unknown option %s\n", name.c_str());
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::string	input; // recorded TS file
+	int			frames; // synthetic frames
+	int			runs;
+	double		bitrate; // Mbps of the synthetic video
+	int			fps;
+	int			gop; // frames
+};
+
+/*!
+Media frame with its own copy of the data */
+struct Frame : virtual Object {
+	Frame(UInt16 track, const Media::Audio::Tag& tag, const Packet& packet) : isVideo(false), track(track), audio(tag), data(packet.data(), packet.data() + packet.size()) {}
+	Frame(UInt16 track, const Media::Video::Tag& tag, const Packet& packet) : isVideo(true), track(track), video(tag), data(packet.data(), packet.data() + packet.size()) {}
+
+	bool					isVideo;
+	UInt16					track;
+	Media::Audio::Tag		audio;
+	Media::Video::Tag		video;
+	std::vector<UInt8>		data;
+};
+
+/*!
+Media source counting the frames demuxed, or recording them */
+struct Sink : Media::Source, virtual Object {
+	Sink(std::vector<Frame>* pFrames = NULL) : frames(0), bytes(0), _pFrames(pFrames) {}
+
+	void writeAudio(UInt16 track, const Media::Audio::Tag& tag, const Packet& packet, bool reliable = true) {
+		++frames;
+		bytes += packet.size();
+		if (_pFrames)
+			_pFrames->emplace_back(track, tag, packet);
+	}
+	void writeVideo(UInt16 track, const Media::Video::Tag& tag, const Packet& packet, bool reliable = true) {
+		++frames;
+		bytes += packet.size();
+		if (_pFrames)
+			_pFrames->emplace_back(track, tag, packet);
+	}
+	void writeData(UInt16 track, Media::Data::Type type, const Packet& packet, bool reliable = true) {}
+	void setProperties(UInt16 track, DataReader& reader) {}
+	void reportLost(Media::Type type, UInt32 lost, UInt16 track = 0) {}
+	void flush() {}
+	void reset() {}
+
+	UInt64	frames;
+	UInt64	bytes; // frame bytes delivered, copied from the TS payloads by the reader
+private:
+	std::vector<Frame>* _pFrames;
+};
+
+struct Result {
+	Result() : ns(0), frames(0), copied(0), allocations(0) {}
+
+	void print(const char* name) const {
+		printf("%-8s %10.0f %14.0f %14.2f\n", name, frames ? double(ns) / frames : 0, frames ? double(copied) / frames : 0, frames ? double(allocations) / frames : 0);
+	}
+
+	Int64	ns;
+	UInt64	frames;
+	UInt64	copied;
+	UInt64	allocations;
+};
+
+static void Synthesize(const BenchOptions& options, std::vector<Frame>& frames) {
+	// Baseline profile config (AVCDecoderConfigurationRecord with one SPS and one PPS), AAC-LC 44100Hz stereo config
+	static const UInt8 VideoConfig[] = { 0x01, 0x42, 0x00, 0x1E, 0xFF, 0xE1, 0x00, 0x09, 0x67, 0x42, 0x00, 0x1E, 0x95, 0xA8, 0x28, 0x0F, 0x64, 0x01, 0x00, 0x04, 0x68, 0xCE, 0x3C, 0x80 };
+	static const UInt8 AudioConfig[] = { 0x12, 0x10 };
+	Media::Video::Tag video(Media::Video::CODEC_H264);
+	video.frame = Media::Video::FRAME_CONFIG;
+	frames.emplace_back(0, video, Packet(VideoConfig, sizeof(VideoConfig)));
+	Media::Audio::Tag audio(Media::Audio::CODEC_AAC);
+	audio.isConfig = true;
+	audio.rate = 44100;
+	audio.channels = 2;
+	frames.emplace_back(0, audio, Packet(AudioConfig, sizeof(AudioConfig)));
+	audio.isConfig = false;
+
+	std::vector<UInt8> data;
+	UInt32 audioTime = 0;
+	for (int index = 0; index < options.frames; ++index) {
+		// One NAL unit: size, header, then filler without start code emulation
+		UInt32 size = max<UInt32>(16, UInt32(options.bitrate * 1000000 / 8 / options.fps));
+		bool key = (index % options.gop) == 0;
+		data.assign(size, 0xAA);
+		UInt32 nalSize = size - 4;
+		data[0] = nalSize >> 24; data[1] = nalSize >> 16; data[2] = nalSize >> 8; data[3] = nalSize & 0xFF;
+		data[4] = key ? 0x65 : 0x41;
+		video.frame = key ? Media::Video::FRAME_KEY : Media::Video::FRAME_INTER;
+		video.time = UInt32(Int64(index) * 1000 / options.fps);
+		frames.emplace_back(0, video, Packet(data.data(), data.size()));
+
+		// AAC frames of 1024 samples (~23ms) at 128kbps until the next video frame
+		for (; audioTime <= video.time; audioTime += 23) {
+			data.assign(370, 0x21);
+			audio.time = audioTime;
+			frames.emplace_back(0, audio, Packet(data.data(), data.size()));
+		}
+	}
+}
+
+static Result Mux(const std::vector<Frame>& frames, std::vector<TSPacker::Payload>& payloads) {
+	Result result;
+	TSWriter tsWriter;
+	TSPacker tsPacker;
+	tsPacker.onPayload = [&payloads](const TSPacker::Payload& payload) { payloads.emplace_back(payload); };
+	UInt8 flags = 0;
+	TSWriter::OnWrite onWrite([&tsPacker, &flags](const Packet& output) { tsPacker.write(output, flags); });
+	payloads.reserve(payloads.size() + 65536);
+
+	UInt64 allocations = Allocations;
+	Int64 start = Now();
+	flags = TSPacker::FLAG_PSI;
+	tsWriter.beginMedia(onWrite);
+	for (const Frame& frame : frames) {
+		Packet packet(frame.data.data(), frame.data.size());
+		if (frame.isVideo) {
+			flags = frame.video.frame == Media::Video::FRAME_KEY ? (TSPacker::FLAG_VIDEO | TSPacker::FLAG_KEY) : TSPacker::FLAG_VIDEO;
+			tsWriter.writeVideo(frame.track, frame.video, packet, onWrite);
+		} else {
+			flags = TSPacker::FLAG_AUDIO;
+			tsWriter.writeAudio(frame.track, frame.audio, packet, onWrite);
+		}
+		++result.frames;
+	}
+	tsWriter.endMedia(onWrite);
+	tsPacker.flush();
+	result.ns = Now() - start;
+	result.allocations = Allocations - allocations;
+	// TS packets built by TSWriter then copied into the payloads by TSPacker
+	result.copied = tsPacker.bytes() * 2;
+	return result;
+}
+
+static Result Demux(const std::vector<TSPacker::Payload>& payloads) {
+	Result result;
+	TSReader tsReader;
+	Sink sink;
+
+	UInt64 allocations = Allocations;
+	Int64 start = Now();
+	for (const TSPacker::Payload& payload : payloads)
+		tsReader.read(payload, sink);
+	tsReader.flush(sink);
+	result.ns = Now() - start;
+	result.allocations = Allocations - allocations;
+	result.frames = sink.frames;
+	result.copied = sink.bytes;
+	return result;
+}
+
+static bool Load(const string& path, std::vector<Frame>& frames) {
+	FILE* pFile = fopen(path.c_str(), "rb");
+	if (!pFile) {
+		fprintf(stderr, "Can't open %s\n", path.c_str());
+		return false;
+	}
+	TSReader tsReader;
+	Sink sink(&frames);
+	UInt8 buffer[TSPacker::PAYLOAD_SIZE];
+	while (size_t size = fread(buffer, 1, sizeof(buffer), pFile))
+		tsReader.read(Packet(buffer, size), sink);
+	tsReader.flush(sink);
+	fclose(pFile);
+	return !frames.empty();
+}
+
+static void Keep(Result& best, const Result& result) {
+	if (!best.frames || result.ns < best.ns)
+		best = result;
+}
+
+int main(int argc, const char* argv[]) {
+	BenchOptions options;
+	if (!options.parse(argc, argv))
+		return 1;
+
+	std::vector<Frame> frames;
+	if (options.input.empty())
+		Synthesize(options, frames);
+	else if (!Load(options.input, frames))
+		return 1;
+	UInt64 bytes = 0;
+	for (const Frame& frame : frames)
+		bytes += frame.data.size();
+	printf("%u frames, %.0f bytes/frame on average, best of %d runs\n", UInt32(frames.size()), double(bytes) / frames.size(), options.runs);
+
+	Result mux, demux;
+	for (int run = 0; run < options.runs; ++run) {
+		std::vector<TSPacker::Payload> payloads;
+		Keep(mux, Mux(frames, payloads));
+		Keep(demux, Demux(payloads));
+	}
+	printf("%-8s %10s %14s %14s\n", "", "ns/frame", "copied/frame", "allocs/frame");
+	mux.print("mux");
+	demux.print("demux");
+	return 0;
+}
@@ -1,14 +1,14 @@
 #!/bin/sh
 
-[ -d srt-1.2.2 ] || {
-	wget https://github.com/Haivision/srt/archive/v1.2.2.tar.gz || { 
+[ -d srt-1.4.2 ] || {
+	wget https://github.com/Haivision/srt/archive/v1.4.2.tar.gz || { 
 		echo "can't download SRT."; 
 		exit 1;
 	}
-	tar -xvf v1.2.2.tar.gz
+	tar -xvf v1.4.2.tar.gz
 }
 
-cd srt-1.2.2 && {
+cd srt-1.4.2 && {
 	./configure --prefix=../srt
 	make && make install
 } || {
@@ -0,0 +1,50 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include "Mona/Buffer.h"
+
+/*!
+Pool of fixed-capacity buffers shared between threads, a buffer acquired on one thread
+goes back to the pool when its last reference is released (on any thread) */
+struct BufferPool : virtual Mona::Object {
+	BufferPool(Mona::UInt32 bufferSize, Mona::UInt32 maxBuffers);
+
+	// Return an empty buffer with a capacity of at least bufferSize bytes
+	Mona::shared<Mona::Buffer> acquire();
+
+	Mona::UInt64 hits() const { return _hits; }
+	Mona::UInt64 misses() const { return _misses; }
+
+	const Mona::UInt32 bufferSize;
+
+private:
+	struct Slab : virtual Mona::Object {
+		Slab(Mona::UInt32 maxBuffers) : maxBuffers(maxBuffers) {}
+		~Slab();
+
+		void release(Mona::Buffer* pBuffer);
+
+		const Mona::UInt32			maxBuffers;
+		std::mutex					access;
+		std::vector<Mona::Buffer*>	buffers;
+	};
+
+	Mona::shared<Slab>			_pSlab; // shared with the buffers in use, can outlive the pool
+	std::atomic<Mona::UInt64>	_hits;
+	std::atomic<Mona::UInt64>	_misses;
+};
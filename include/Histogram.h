@@ -0,0 +1,48 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+
+/*!
+Lock-free histogram of durations in microseconds, log-linear buckets with 16 sub-buckets per power of 2
+(precision better than 7%), values can be recorded from any thread */
+struct Histogram : virtual Mona::Object {
+	Histogram();
+
+	void record(Mona::UInt64 value);
+	void reset();
+
+	Mona::UInt64 count() const { return _count; }
+	Mona::UInt64 max() const { return _max; }
+	Mona::UInt64 sum() const { return _sum; }
+	// Number of values recorded up to value (bucket precision)
+	Mona::UInt64 count(Mona::UInt64 value) const;
+	// Value under which there are ratio (0..1) of the recorded values
+	Mona::UInt64 percentile(double ratio) const;
+
+private:
+	static const Mona::UInt8 SUB_BITS = 4;
+	static const Mona::UInt32 BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+	static Mona::UInt32 Index(Mona::UInt64 value);
+	static Mona::UInt64 Value(Mona::UInt32 index); // upper bound of the bucket
+
+	std::atomic<Mona::UInt64>	_count;
+	std::atomic<Mona::UInt64>	_max;
+	std::atomic<Mona::UInt64>	_sum;
+	std::atomic<Mona::UInt32>	_buckets[BUCKETS];
+};
@@ -0,0 +1,60 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "Histogram.h"
+
+/*!
+Per-stage latency histograms of the output and ingest pipelines (microseconds).
+Compiled only with SRT_LATENCY defined (make LATENCY=1), otherwise the LATENCY macros expand to nothing:
+no stamp carried with the frames and payloads and no recording. Stamps are steady_clock nanoseconds */
+struct Latency : virtual Mona::Object {
+	enum Stage {
+		// output
+		STAGE_MUX_QUEUE = 0, // RTMP frame received (main thread) -> taken by the muxing thread
+		STAGE_MUX, // TS muxing of a frame
+		STAGE_PAYLOAD, // first TS packet packed -> payload complete
+		STAGE_SEND_QUEUE, // payload queued -> srt_sendmsg
+		STAGE_SEND, // srt_sendmsg call
+		// ingest
+		STAGE_BATCH, // srt_recvmsg of the first message -> batch demuxed
+		STAGE_HANDLER, // frames of a batch queued -> main thread dispatch
+		STAGE_DEMUX, // TSReader::read of a batch (SRTIn thread)
+		STAGES
+	};
+
+	static bool Enabled();
+	static Mona::Int64 Now() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+	static void Record(Stage stage, Mona::Int64 stamp) { Histograms()[stage].record(Mona::UInt64(std::max<Mona::Int64>(0, Now() - stamp)) / 1000); }
+
+	// Count, percentiles 50/90/99/99.9 and max of every stage
+	static std::string& WriteJSON(std::string& out);
+	static void Log();
+	static void Reset();
+
+private:
+	static Histogram* Histograms();
+};
+
+#if defined(SRT_LATENCY)
+#define LATENCY_FIELD(NAME)				Mona::Int64 NAME
+#define LATENCY_STAMP(VAR)				VAR = Latency::Now()
+#define LATENCY_RECORD(STAGE, STAMP)	Latency::Record(Latency::STAGE, STAMP)
+#else
+#define LATENCY_FIELD(NAME)
+#define LATENCY_STAMP(VAR)
+#define LATENCY_RECORD(STAGE, STAMP)
+#endif
@@ -21,11 +21,14 @@
 #include "App.h"
 
 struct SRTIn;
+struct SRTServer;
+struct SRTRuntime;
+struct SRTStats;
 namespace Mona {
 
 struct MonaSRT : Server {
 	MonaSRT(const std::string& wwwPath, UInt16 cores, TerminateSignal& terminateSignal) :
-		Server(cores), _wwwPath(wwwPath), _terminateSignal(terminateSignal), _srtIn(nullptr) { }
+		Server(cores), _wwwPath(wwwPath), _terminateSignal(terminateSignal), _srtIn(nullptr), _srtServer(nullptr), _srtRuntime(nullptr), _srtStats(nullptr) { }
 
 	virtual ~MonaSRT() { stop(); }
 
@@ -58,6 +61,9 @@ protected:
 	TerminateSignal&			_terminateSignal;
 	std::map<std::string,App*>	_applications;
 	SRTIn*						_srtIn;
+	SRTServer*					_srtServer;
+	SRTRuntime*					_srtRuntime;
+	SRTStats*					_srtStats;
 	std::string					_wwwPath;
 };
 
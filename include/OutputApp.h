@@ -16,17 +16,19 @@
 #pragma once
 
 #include "App.h"
-#include "Mona/TSWriter.h"
+#include "Mona/ServerAPI.h"
+#include "TSMux.h"
+#include "SRTOutput.h"
 
 struct OutputApp : virtual Mona::App {
 
 	struct Client : App::Client, virtual Mona::Object {
-		Client(Mona::Client& client, const std::string& host);
+		Client(Mona::Client& client, OutputApp& app);
 		virtual ~Client();
 
 		/* Client implementation */
 		virtual void onAddressChanged(const Mona::SocketAddress& oldAddress) {}
-		virtual bool onInvocation(Mona::Exception& ex, const std::string& name, Mona::DataReader& arguments, Mona::UInt8 responseType) { return true; }
+		virtual bool onInvocation(Mona::Exception& ex, const std::string& name, Mona::DataReader& arguments, Mona::UInt8 responseType);
 		virtual bool onFileAccess(Mona::Exception& ex, Mona::File::Mode mode, Mona::Path& file, Mona::DataReader& arguments, Mona::DataWriter& properties) { return true; }
 
 		virtual bool onPublish(Mona::Exception& ex, Mona::Publication& publication);
@@ -37,49 +39,20 @@ struct OutputApp : virtual Mona::App {
 	
 	private:
 
-		// Push the current frame into the TS writer
-		template <class Tag>
-		Mona::shared<Mona::Buffer>& writeFrame(Mona::shared<Mona::Buffer>& pBuffer, const Tag& tag, const Mona::Packet& packet) {
-
-			pBuffer.reset(new Mona::Buffer());
-			Mona::BinaryWriter writer(*pBuffer);
-			if (_first) {
-				_tsWriter.beginMedia([&writer](const Mona::Packet& output) { writer.write(output); });
-				_first = false;
-			}
-			writeMedia(writer, tag, packet);
-			return pBuffer;
-		}
-
-		template <class Tag>
-		void writeMedia(Mona::BinaryWriter& writer, const Tag& tag, const Mona::Packet& packet);
-
-		// Inject the TS buffer into SRT 
-		// return False if an error occurs, True otherwise
-		bool writePayload(Mona::UInt16 context, std::shared_ptr<Mona::Buffer>& pBuffer);
-
 		// Reset the SRT connection
 		void resetSRT();
 
-		// FLV
-		Mona::TSWriter								_tsWriter;
-		Mona::Packet								_videoCodec; // video codec to be saved
-		bool										_videoCodecSent;
-		Mona::Packet								_audioCodec; // audio codec to be saved
-		bool										_audioCodecSent;
-		bool										_first; // To write the FLV header when the first packet is written
-
-		std::string									_host; // host address to connect to (and bind to)
+		OutputApp&									_app;
+		Mona::Timer::OnTimer						_onFlush;
 		Mona::Publication::OnAudio					_onAudio;
 		Mona::Publication::OnVideo					_onVideo;
 		Mona::Publication::OnEnd					_onEnd;
 		Mona::Publication*							_pPublication;
-		
-		class OpenSrtPIMPL;
-		std::unique_ptr<OpenSrtPIMPL> _srtPimpl;
+		Mona::shared<TSMux>							_pMux; // TS muxing on a worker thread
+		std::vector<Mona::shared<SRTOutput>>		_outputs; // SRT sockets handled by the runtime, one by target
 	};
 
-	OutputApp(const Mona::Parameters& configs);
+	OutputApp(const Mona::Parameters& configs, Mona::ServerAPI& api, SRTRuntime& runtime, SRTStats& stats);
 	virtual ~OutputApp();
 
 	virtual void onHandshake(const std::string& protocol, const Mona::SocketAddress& address, const Mona::Parameters& properties, std::set<Mona::SocketAddress>& addresses) {}
@@ -87,6 +60,15 @@ struct OutputApp : virtual Mona::App {
 	virtual OutputApp::Client* newClient(Mona::Exception& ex, Mona::Client& client, Mona::DataReader& parameters, Mona::DataWriter& response);
 
 	virtual void manage() {}
+	Mona::ServerAPI&	api;
+	SRTRuntime&			runtime;
+	SRTStats&			stats;
 private:
-	std::string _target;
+	std::vector<std::pair<std::string, SRTSender::Options>>	_targets; // without their query, and their options
+	std::string					_standby; // optional hot-standby of the first target, connected in advance
+	Mona::UInt32				_holdDelay; // maximum time in ms before sending a partial payload
+	Mona::UInt32				_frameQueue; // maximum number of frames waiting for muxing
+	Mona::UInt32				_gopCache; // maximum size in bytes of the GOP cached for new outputs
+	Mona::UInt32				_configInterval; // minimum time in ms between two codec infos sent on keyframes
+	Mona::UInt32				_sourceDrift; // maximum lag in ms of the source times, for the target with the smallest latency
 };
@@ -0,0 +1,80 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+
+/*!
+Bounded lock-free queue for one producer thread and one consumer thread */
+template<typename Type>
+struct SPSCQueue : virtual Mona::Object {
+	SPSCQueue(Mona::UInt32 capacity) : _slots(Capacity(capacity)), _mask(_slots.size() - 1), _head(0), _tail(0) {}
+
+	// Producer thread, return false if the queue is full
+	bool push(Type&& value) {
+		Mona::UInt32 tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head.load(std::memory_order_acquire) >= _slots.size())
+			return false;
+		_slots[tail & _mask] = std::move(value);
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+	// Consumer thread, return false if the queue is empty
+	bool pop(Type& value) {
+		Mona::UInt32 head = _head.load(std::memory_order_relaxed);
+		if (head == _tail.load(std::memory_order_acquire))
+			return false;
+		Type& slot = _slots[head & _mask];
+		value = std::move(slot);
+		slot = Type(); // release the resources now
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer thread, oldest value or NULL if the queue is empty
+	Type* front() {
+		Mona::UInt32 head = _head.load(std::memory_order_relaxed);
+		return head == _tail.load(std::memory_order_acquire) ? NULL : &_slots[head & _mask];
+	}
+	// Consumer thread, remove the oldest value
+	bool pop() {
+		Type* pValue = front();
+		if (!pValue)
+			return false;
+		*pValue = Type();
+		_head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const { return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire); }
+	Mona::UInt32 size() const { return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire); }
+	Mona::UInt32 capacity() const { return _slots.size(); }
+
+private:
+	static Mona::UInt32 Capacity(Mona::UInt32 capacity) {
+		Mona::UInt32 power(2);
+		while (power < capacity)
+			power <<= 1;
+		return power;
+	}
+
+	std::vector<Type>							_slots;
+	const Mona::UInt32							_mask;
+	// positions on distinct cache lines to avoid false sharing between the threads
+	std::atomic<Mona::UInt32>					_head; // consumer position
+	char										_padding[64];
+	std::atomic<Mona::UInt32>					_tail; // producer position
+};
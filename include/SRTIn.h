@@ -15,52 +15,176 @@
 
 #pragma once
 
-#if defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__) && !defined(WIN32)
-	#define WIN32
-#endif
-#include <srt/srt.h>
-#undef LOG_INFO
-#undef LOG_DEBUG
-#undef min
-#undef max
-
+#include "SRTOutput.h"
+#include "TSInspector.h"
 #include "Mona/Thread.h"
 #include "Mona/ServerAPI.h"
 #include "Mona/TSReader.h"
+#include "BufferPool.h"
+#include "SRTStats.h"
+#include "Latency.h"
 
+/*!
+SRT listener publishing its callers, the SRT library must be started by a SRTRuntime.
+TS is demuxed on the SRTIn thread, only complete media frames are queued to the main thread by batches.
+Every received message is analyzed by a TSInspector, its health counters go to the caller statistics and the logs.
+Its delivery delay (reading time after the TSBPD delivery time given by srctime) and its jitter go to the statistics too,
+srctime doesn't carry the sending time end to end, so the transit over the hop is not measured.
+In relay mode (srt.relay) the received messages are also forwarded as-is, by reference, to SRT outputs,
+and the TS is demuxed only while the publication has subscribers */
 struct SRTIn : private Mona::Thread {
 
-	SRTIn(const Mona::Parameters& configs, Mona::ServerAPI& api);
+	SRTIn(const Mona::Parameters& configs, Mona::ServerAPI& api, SRTRuntime& runtime, SRTStats& stats);
 	virtual ~SRTIn();
 
 	bool load();
 	virtual void stop();
 
+	// Main thread, subscriptions accepted on a publication (demuxed only while subscribed in relay mode)
+	void onSubscribe(const Mona::Publication& publication);
+	void onUnsubscribe(const Mona::Publication& publication);
+
+	// Reception buffers, hits and misses count the recycled and allocated batches
+	const BufferPool& pool() const { return _pool; }
+
 private:
+	// Media frame demuxed, its packet shares the TSReader buffer
+	struct TSFrame {
+		TSFrame(Mona::UInt16 track, const Mona::Media::Audio::Tag& tag, const Mona::Packet& packet) : type(Mona::Media::TYPE_AUDIO), track(track), audio(tag), packet(std::move(packet)) {}
+		TSFrame(Mona::UInt16 track, const Mona::Media::Video::Tag& tag, const Mona::Packet& packet) : type(Mona::Media::TYPE_VIDEO), track(track), video(tag), packet(std::move(packet)) {}
+		TSFrame(Mona::UInt16 track, Mona::Media::Data::Type type, const Mona::Packet& packet) : type(Mona::Media::TYPE_DATA), track(track), data(type), packet(std::move(packet)) {}
+
+		Mona::Media::Type			type;
+		Mona::UInt16				track;
+		Mona::Media::Audio::Tag		audio;
+		Mona::Media::Video::Tag		video;
+		Mona::Media::Data::Type		data;
+		Mona::Packet				packet;
+	};
+	// Media source collecting the frames read by the TSReader of a caller (thread)
+	struct Demuxer : Mona::Media::Source, virtual Mona::Object {
+		Demuxer() : lost(0) {}
+
+		void writeAudio(Mona::UInt16 track, const Mona::Media::Audio::Tag& tag, const Mona::Packet& packet, bool reliable = true) { frames.emplace_back(track, tag, packet); }
+		void writeVideo(Mona::UInt16 track, const Mona::Media::Video::Tag& tag, const Mona::Packet& packet, bool reliable = true) { frames.emplace_back(track, tag, packet); }
+		void writeData(Mona::UInt16 track, Mona::Media::Data::Type type, const Mona::Packet& packet, bool reliable = true) { frames.emplace_back(track, type, packet); }
+		// Properties can't be read out of the thread, they are not forwarded
+		void setProperties(Mona::UInt16 track, Mona::DataReader& reader) {}
+		void reportLost(Mona::Media::Type type, Mona::UInt32 lost, Mona::UInt16 track = 0) { this->lost += lost; }
+		void flush() {}
+		void reset() {}
+
+		std::vector<TSFrame>	frames;
+		Mona::UInt32			lost; // frames lost reported by the reader
+	};
+	// Received messages of a caller batched then demuxed before being queued to the main thread (thread)
+	struct Caller {
+		Caller() : time(0), latency(0), delivery(0), demuxing(true), errors(0), reportTime(0), gopSize(-1) {}
+
+		struct Message {
+			Message(Mona::UInt32 size, Mona::UInt8 flags, Mona::Int64 time) : size(size), flags(flags), time(time) {}
+			Mona::UInt32	size;
+			Mona::UInt8		flags; // TSPacker flags
+			Mona::Int64		time; // source time on the libsrt clock, 0 if unknown
+		};
 
-	// Close the socket if created
+		Mona::shared<Mona::Buffer>	pBatch;
+		std::vector<Message>		messages; // messages batched, relay mode only
+		Mona::Int64					time; // reception time of the first message batched
+		Mona::shared<SRTStats::Series>	pStats;
+		std::string					streamId;
+		Mona::Int64					latency; // SRT receiving latency in microseconds
+		Mona::Int64					delivery; // delivery delay of the last message in microseconds
+		Mona::TSReader				tsReader;
+		Demuxer						demuxer;
+		bool						demuxing;
+		Mona::shared<std::atomic<bool>>	pDemux; // set by the main thread while the publication is subscribed, relay mode only
+		TSInspector					inspector;
+		Mona::UInt32				errors; // TS errors already logged
+		Mona::Int64					reportTime; // last TS errors log
+		// relay mode
+		std::vector<Mona::shared<SRTOutput>>	outputs;
+		std::deque<TSPacker::Payload>		gop; // messages since the last video random access point
+		Mona::UInt32						gopSize; // bytes cached, -1 if overflowed until the next random access point
+		LATENCY_FIELD(stamp); // reception time of the first message batched
+	};
+
+	// Close the listening socket if created
 	void disconnect();
 
 	virtual bool run(Mona::Exception&, const volatile bool& requestStop);
 
-	// Safe-Threaded structure to send TS data to the running publication
-	struct TSPacket : Mona::Packet, virtual Mona::Object {
-		TSPacket(const Mona::Packet& packet) : Packet(std::move(packet)) {}
+	// Accept all pending callers of the listening socket and add them to the epoll set
+	void accept(int epollid);
+	// Read all the messages available on a caller socket, return false if the connection is lost
+	bool receive(::SRTSOCKET socket, Caller& caller);
+	// Source time of a received message from its SRT delivery time (srctime), its delivery delay and jitter are recorded
+	static Mona::Int64 SourceTime(Caller& caller, const ::SRT_MSGCTRL& control);
+	// Demux the current batch of the caller and queue its frames to the main thread, end flushes the TS reader
+	void flush(::SRTSOCKET socket, Caller& caller, bool end = false);
+	// Log the new TS errors of the caller, at most every 10s
+	void report(Caller& caller, Mona::Int64 now);
+	// Forward the messages of the batch to the relay outputs
+	void relay(Caller& caller, const Mona::Packet& batch);
+	// Remove the caller from the epoll set, close it and release its publication
+	void close(int epollid, ::SRTSOCKET socket);
+	// libsrt thread, auto tuning: latency of an incoming caller from the RTT of its previous connection
+	static int OnListen(void* opaque, ::SRTSOCKET socket, int hsVersion, const sockaddr* pAddress, const char* streamId);
+
+	// A SRT caller and its publication (main thread)
+	struct Stream : virtual Mona::Object {
+		Stream(const std::string& name, const Mona::shared<std::atomic<bool>>& pDemux) : name(name), pPublication(NULL), pDemux(pDemux), subscribers(0) {}
 
+		const std::string	name;
+		Mona::Publication*	pPublication;
+		const Mona::shared<std::atomic<bool>>	pDemux;
+		Mona::UInt32		subscribers;
 	};
-	typedef Mona::Event<void(TSPacket&)>	ON(TSPacket);
-	typedef Mona::Event<void()>				ON(TSReset);
 
-	static void LogCallback(void* opaque, int level, const char* file, int line, const char* area, const char* message);
+	// Safe-Threaded structures to send TS data to the running publications
+	struct TSConnection : virtual Mona::Object {
+		TSConnection(::SRTSOCKET socket, const std::string& streamId, const Mona::shared<std::atomic<bool>>& pDemux) : socket(socket), streamId(streamId), pDemux(pDemux) {}
+
+		const ::SRTSOCKET	socket;
+		const std::string	streamId;
+		const Mona::shared<std::atomic<bool>>	pDemux;
+	};
+	struct TSFrames : virtual Mona::Object {
+		TSFrames(::SRTSOCKET socket, std::vector<TSFrame>& frames, Mona::UInt32 lost) : socket(socket), lost(lost) { this->frames.swap(frames); LATENCY_STAMP(stamp); }
+
+		const ::SRTSOCKET		socket;
+		std::vector<TSFrame>	frames;
+		const Mona::UInt32		lost;
+		LATENCY_FIELD(stamp); // queuing time
+	};
+	struct TSReset : virtual Mona::Object {
+		TSReset(::SRTSOCKET socket) : socket(socket) {}
+
+		const ::SRTSOCKET	socket;
+	};
+	typedef Mona::Event<void(TSConnection&)>	ON(TSConnection);
+	typedef Mona::Event<void(TSFrames&)>		ON(TSFrames);
+	typedef Mona::Event<void(TSReset&)>			ON(TSReset);
 
-	std::string				_host;
-	std::string				_name;
-	Mona::Publication*		_publication;
-	bool					_started;
-	Mona::TSReader			_tsReader;
+	std::string										_host;
+	std::string										_name; // publication name of callers without streamid
+	bool											_started;
+	std::map<::SRTSOCKET, Mona::shared<Stream>>		_streams; // SRT callers by socket (main thread)
 
 	// members used by thread
-	Mona::SocketAddress		_addr;
-	Mona::ServerAPI&		_api;
-	::SRTSOCKET				_socket;
+	Mona::SocketAddress								_addr;
+	Mona::ServerAPI&								_api;
+	SRTRuntime&										_runtime;
+	SRTStats&										_stats;
+	std::vector<std::pair<std::string, SRTSender::Options>>	_relays; // relay targets without their query, and their options
+	SRTRuntime::Tuning								_tuning; // options of the listener, inherited by the callers
+	std::mutex										_mutex;
+	std::map<std::string, double>					_rtts; // auto tuning, RTT of the last caller by streamid
+	Mona::UInt32									_gopCache;
+	::SRTSOCKET										_socket;
+	int												_backlog;
+	Mona::UInt32									_batchDelay;
+	BufferPool										_pool;
+	std::map<::SRTSOCKET, Caller>					_callers;
+	std::vector<::SRTSOCKET>						_readySockets;
 };
@@ -0,0 +1,98 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#if defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__) && !defined(WIN32)
+	#define WIN32
+#endif
+#include <srt/srt.h>
+#undef LOG_INFO
+#undef LOG_DEBUG
+#undef min
+#undef max
+
+#include "Mona/Mona.h"
+#include "Mona/Parameters.h"
+#include "Mona/Thread.h"
+#include "Mona/Signal.h"
+
+/*!
+Asynchronous sink of the libsrt logs: libsrt filters the levels and the areas (srt.logAreas), formats only the message,
+and the SRT threads copy it into a lock-free ring,
+a background thread filters repeated messages, rate-limits and writes them into the server logs.
+libsrt logs are process-wide, so are the dropped message counters */
+struct SRTLog : private Mona::Thread {
+	SRTLog(const Mona::Parameters& configs);
+	~SRTLog() { stop(); }
+
+	// Install the libsrt log handler, after srt_startup
+	bool start();
+	// Remove the libsrt log handler and write the messages still queued
+	void stop();
+
+	static Mona::UInt64 Overflows() { return _Overflows; } // messages lost, ring full
+	static Mona::UInt64 RateDrops() { return _RateDrops; } // messages over srt.logRate
+	static Mona::UInt64 Duplicates() { return _Duplicates; } // repetitions of the previous message
+
+private:
+	friend struct SRTLogTest; // feeds the libsrt log handler
+
+	struct Entry {
+		Entry() : sequence(0), level(0), size(0) {}
+
+		std::atomic<Mona::UInt32>	sequence; // Vyukov slot sequence
+		Mona::UInt8					level;
+		char						area[16];
+		Mona::UInt16				size;
+		char						message[470];
+	};
+
+	static void Callback(void* opaque, int level, const char* file, int line, const char* area, const char* message);
+
+	// SRT threads
+	void push(int level, const char* area, const char* message);
+	// Log thread
+	bool run(Mona::Exception& ex, const volatile bool& requestStop);
+	bool pop(Entry& entry);
+	void write(const Entry& entry);
+	void write(Mona::UInt8 level, const std::string& area, const std::string& message);
+	void repeated();
+
+	const int						_level; // maximum libsrt level logged (LOG_CRIT 2 ... LOG_DEBUG 7)
+	std::vector<int>				_areas; // SRT_LOGFA_* logged, all if empty
+	const Mona::UInt32				_rate; // messages by second
+	bool							_started;
+	std::vector<Entry>				_entries;
+	const Mona::UInt32				_mask;
+	std::atomic<Mona::UInt32>		_head; // producers position
+	char							_padding[64];
+	std::atomic<Mona::UInt32>		_tail; // consumer position
+	Mona::Signal					_wakeUp;
+
+	// members used by the log thread
+	double							_tokens;
+	Mona::Int64						_tokensTime;
+	Mona::UInt8						_lastLevel;
+	std::string						_lastArea;
+	std::string						_lastMessage;
+	Mona::UInt32					_repeats;
+	Mona::Int64						_reportTime;
+	Mona::UInt64					_reported; // drops already reported
+
+	static std::atomic<Mona::UInt64>	_Overflows;
+	static std::atomic<Mona::UInt64>	_RateDrops;
+	static std::atomic<Mona::UInt64>	_Duplicates;
+};
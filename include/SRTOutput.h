@@ -0,0 +1,72 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "SRTSender.h"
+
+/*!
+SRT caller output to a target host, the sockets are owned by a SRTRuntime reactor which resolves,
+connects, reconnects and drains them.
+The host can be an ordered failover list ("cdn1:4900|cdn2:4900|cdn3:4900", the standby host is appended to it),
+every link is kept connected and gets a health score every second from its RTT, loss rate and sending buffer.
+Traffic switches on the next keyframe to the first healthy link of the list when the score of the active link
+drops under failoverScore, or to an earlier link of the list healthy again, a link is healthy with failoverHysteresis points
+above failoverScore and no switch happens during failoverHold ms after the last one.
+When the active link breaks traffic switches at once to the best connected link,
+while the broken one is rebuilt in background */
+struct SRTOutput : SRTSender, SRTRuntime::Socket, virtual Mona::Object {
+	SRTOutput(const Options& options, const std::string& host, const std::string& standby = "", const Mona::shared<SRTStats::Series>& pStats = nullptr, const std::string& streamId = "");
+
+	Mona::UInt32 failovers() const { return _failovers; }
+
+	const std::string host;
+	const std::string streamId; // SRTO_STREAMID of the sockets, none if empty
+
+private:
+	struct Link {
+		Link(const std::string& host) : host(host), socket(::SRT_INVALID_SOCK), connected(false), connectTime(0), score(-1), sent(0), lost(0) {}
+		const std::string	host;
+		::SRTSOCKET			socket;
+		bool				connected;
+		Mona::Int64			connectTime; // time of the last connection attempt
+		double				score; // smoothed health score from 0 to 100, -1 until measured
+		Mona::Int64			sent; // packets sent at the last score
+		Mona::Int32			lost; // packets lost on sending at the last score
+	};
+
+	// Reactor thread
+	void onManage(SRTRuntime::Reactor& reactor, Mona::Int64 now);
+	void onReadable(SRTRuntime::Reactor& reactor, ::SRTSOCKET socket);
+	void onWritable(SRTRuntime::Reactor& reactor, ::SRTSOCKET socket);
+	void onClose(SRTRuntime::Reactor& reactor);
+
+	Link* link(::SRTSOCKET socket);
+	bool connect(SRTRuntime::Reactor& reactor, Link& link, const Mona::SocketAddress& address);
+	void disconnect(SRTRuntime::Reactor& reactor, Link& link);
+	// Update the health score of a connected link
+	void score(Link& link);
+	// Switch to a healthier link on the next keyframe if the active one is degraded or an earlier link is healthy again
+	void select(Mona::Int64 now);
+	// Best connected link except the given one: the first healthy one of the list, otherwise the best score
+	Link* candidate(const Link* pExcept);
+
+	std::atomic<Mona::UInt32>	_failovers;
+
+	// members used by reactor
+	std::vector<Link>			_links; // failover list, one of them is the active link
+	Mona::Int64					_scoreTime;
+	Mona::Int64					_switchTime; // last switch or switch request
+};
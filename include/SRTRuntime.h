@@ -0,0 +1,177 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#if defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__) && !defined(WIN32)
+	#define WIN32
+#endif
+#include <srt/srt.h>
+#undef LOG_INFO
+#undef LOG_DEBUG
+#undef min
+#undef max
+
+#include "Mona/Mona.h"
+#include "Mona/Parameters.h"
+#include "Mona/SocketAddress.h"
+#include "Mona/Thread.h"
+#include "SRTLog.h"
+
+/*!
+Process-wide SRT context: starts the SRT library once and runs a small fixed pool of reactor threads
+which own the SRT sockets of all the outputs (connection, reconnection, draining) */
+struct SRTRuntime : virtual Mona::Object {
+	struct Reactor;
+
+	/*!
+	Socket handled by a reactor, all its events are called from the reactor thread */
+	struct Socket : virtual Mona::Object {
+		// Called on every reactor loop (at least every SRTRuntime::TICK ms) to (re)connect and flush
+		virtual void onManage(Reactor& reactor, Mona::Int64 now) = 0;
+		virtual void onReadable(Reactor& reactor, ::SRTSOCKET socket) {}
+		virtual void onWritable(Reactor& reactor, ::SRTSOCKET socket) {}
+		// Called once removed from the reactor, the SRT sockets have to be closed here
+		virtual void onClose(Reactor& reactor) = 0;
+	};
+
+	/*!
+	Reactor thread with its own SRT epoll set */
+	struct Reactor : private Mona::Thread {
+		Reactor(SRTRuntime& runtime, Mona::UInt16 index);
+		~Reactor();
+
+		// Add the SRT socket to the epoll set for events (SRT_EPOLL_IN, SRT_EPOLL_OUT...), reactor thread only
+		bool watch(::SRTSOCKET socket, Socket& owner, int events);
+		// Remove the SRT socket from the epoll set, reactor thread only
+		void unwatch(::SRTSOCKET socket);
+
+		// Thread-safe
+		void add(const Mona::shared<Socket>& pSocket);
+		void remove(const Mona::shared<Socket>& pSocket);
+		Mona::UInt32 count() const { return _count; }
+
+		bool start() { return Thread::start(); }
+		void stop() { Thread::stop(); }
+
+		SRTRuntime&	runtime;
+
+	private:
+		bool run(Mona::Exception& ex, const volatile bool& requestStop);
+
+		std::mutex								_mutex;
+		std::vector<Mona::shared<Socket>>		_adding;
+		std::vector<Mona::shared<Socket>>		_removing;
+		std::atomic<Mona::UInt32>				_count;
+
+		// members used by thread
+		int										_epollid;
+		std::set<Mona::shared<Socket>>			_sockets;
+		std::map<::SRTSOCKET, Socket*>			_owners;
+		std::vector<::SRTSOCKET>				_readSockets;
+		std::vector<::SRTSOCKET>				_writeSockets;
+	};
+
+	/*!
+	Transport options of a SRT socket (srt.latency, srt.maxBW...), 0 (-1 for maxBW) keeps the libsrt default.
+	An address overrides them with a query, ex: "host:4900?latency=300&inputBW=625000".
+	In auto mode the latency follows the RTT measured on the previous connection and inputBW the observed bitrate */
+	struct Tuning {
+		static const Mona::UInt32 MIN_PAYLOAD_SIZE = 1316; // 7 TS packets, the size of the payloads sent
+
+		Tuning(const Mona::Parameters& configs);
+
+		// Override the options with the query of the address and remove it, return the address
+		std::string& parse(std::string& address);
+		// Set the options before connection (or on a listener, its accepted sockets inherit them), errors are logged and the defaults kept
+		// In auto mode rtt and bitrate, if measured, replace latency and inputBW
+		void apply(::SRTSOCKET socket, double rtt = 0, Mona::Int64 bitrate = 0) const;
+		// Auto mode, latency for a measured RTT in ms: 4 RTT at least
+		Mona::UInt32 latencyFor(double rtt) const;
+
+		Mona::UInt32	latency; // ms of buffering on both sides
+		Mona::Int64		maxBW; // bytes/s, -1 unlimited, 0 for inputBW + overheadBW
+		Mona::Int64		inputBW; // bytes/s of the stream, 0 for the libsrt estimation
+		Mona::UInt32	overheadBW; // % of inputBW for retransmissions (5 to 100)
+		Mona::UInt32	sndBuf; // bytes
+		Mona::UInt32	rcvBuf; // bytes
+		Mona::UInt32	fc; // maximum packets in flight
+		Mona::UInt32	payloadSize; // maximum message size, 0 or MIN_PAYLOAD_SIZE at least
+		bool			autoTuning;
+
+	private:
+		bool set(const std::string& key, const std::string& value);
+	};
+
+	static const Mona::UInt32 TICK = 10; // maximum time in ms between two reactor loops
+
+	SRTRuntime(const Mona::Parameters& configs);
+	~SRTRuntime();
+
+	bool start();
+	void stop();
+
+	// Attach the socket to the least loaded reactor (thread-safe)
+	void add(const Mona::shared<Socket>& pSocket);
+	// Detach the socket, it is closed asynchronously by its reactor (thread-safe)
+	void remove(const Mona::shared<Socket>& pSocket);
+
+	// Cached resolution of host, never blocks: return false until the first resolution succeeds,
+	// then the cached address is refreshed asynchronously every srt.dnsTTL ms (thread-safe)
+	bool resolve(const std::string& host, Mona::SocketAddress& address);
+
+	// Publication name requested by a SRT caller : raw streamid or "r" key of the "#!::" syntax
+	static std::string& BuildName(const std::string& streamId, std::string& name);
+	// Items of a comma-separated list (targets...), trimmed and without the empty ones
+	static std::vector<std::string>& Split(const std::string& list, std::vector<std::string>& items);
+
+private:
+	/*!
+	Host resolutions in background */
+	struct Resolver : private Mona::Thread {
+		Resolver(Mona::UInt32 ttl) : Thread("SRTResolver"), _ttl(ttl) {}
+		~Resolver() { stop(); }
+
+		bool resolve(const std::string& host, Mona::SocketAddress& address);
+
+		bool start() { return Thread::start(); }
+		void stop();
+
+	private:
+		struct Entry {
+			Entry() : time(0), resolved(false), pending(false) {}
+			Mona::SocketAddress	address;
+			Mona::Int64			time; // time of the last resolution
+			bool				resolved;
+			bool				pending;
+		};
+
+		bool run(Mona::Exception& ex, const volatile bool& requestStop);
+
+		const Mona::UInt32					_ttl;
+		std::mutex							_mutex;
+		std::map<std::string, Entry>		_entries;
+		std::deque<std::string>				_requests;
+		Mona::Signal						_wakeUp;
+	};
+
+	bool											_started;
+	Mona::UInt16									_reactorsCount;
+	Resolver										_resolver;
+	SRTLog											_log;
+	std::vector<Mona::unique<Reactor>>				_reactors;
+	std::mutex										_mutex;
+	std::map<Socket*, Reactor*>						_attachments;
+};
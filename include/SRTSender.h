@@ -0,0 +1,157 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "SRTRuntime.h"
+#include "SPSCQueue.h"
+#include "Histogram.h"
+#include "TSPacker.h"
+#include "SRTStats.h"
+
+/*!
+Sending side of a SRT socket: write() never locks, it drops the payload while disconnected,
+otherwise queues it and sends the queue if no other thread is already sending it.
+Once connected, live payloads are dropped until join() has sent the cached GOP, so a receiver always starts on a keyframe.
+On congestion (SRT sending buffer or queue filling up) the payloads are dropped by priority: non-reference video first,
+then the video until the next keyframe, audio and program tables are always sent.
+A token bucket paces the queue at the measured bitrate plus a headroom, so a keyframe burst is spread instead of
+overflowing the bottleneck of the link, the pacing delay is bounded: beyond it the queue is sent at once.
+The socket itself (connection, closing) belongs to a SRTRuntime reactor */
+struct SRTSender : virtual Mona::Object {
+	struct Options {
+		Options(const Mona::Parameters& configs);
+
+		// Override the tuning with the queries of a target or failover list ("host1?latency=300|host2"), return it without the queries
+		std::string& parse(std::string& target);
+		// Maximum lag in ms of a srctime behind the sending time: half the latency, the receiver drops what is delivered after srctime + latency
+		Mona::UInt32 sourceDrift() const { return (tuning.latency ? tuning.latency : 120) / 2; }
+
+		Mona::UInt32	queueSize; // payloads waiting for the SRT sending buffer
+		Mona::UInt32	ttl; // ms before SRT discards an unsent video payload, 0 for infinite (audio, tables and keyframes get twice more)
+		bool			congestion; // drop payloads by priority on congestion
+		Mona::UInt32	pacing; // % of headroom above the measured bitrate, 0 disables the pacing
+		Mona::UInt32	paceDelay; // ms of queue above which the payloads are sent without pacing
+		bool			sourceTime; // send the source time of the payloads as srctime, the receiver delivers them aligned on their media timestamps
+		SRTRuntime::Tuning	tuning; // transport options of the socket
+		// failover of the outputs, health score from 100 (healthy) to 0
+		Mona::UInt32	maxRTT; // ms of RTT giving a score of 0
+		Mona::UInt32	maxLoss; // % of lost packets giving a score of 0
+		Mona::UInt32	failoverScore; // score under which the traffic leaves a target
+		Mona::UInt32	failoverHysteresis; // score above failoverScore required to take a target
+		Mona::UInt32	failoverHold; // ms without switching after a switch
+	};
+	enum Congestion : Mona::UInt8 {
+		CONGESTION_NONE = 0,
+		CONGESTION_MODERATE, // drop non-reference video
+		CONGESTION_SEVERE // drop video until the next keyframe
+	};
+	// Payloads dropped by reason
+	struct Drops {
+		Drops() : disconnected(0), joining(0), full(0), disposable(0), gop(0), ttl(0), errors(0) {}
+
+		std::atomic<Mona::UInt64>	disconnected;
+		std::atomic<Mona::UInt64>	joining; // waiting the cached GOP
+		std::atomic<Mona::UInt64>	full; // sending queue full
+		std::atomic<Mona::UInt64>	disposable; // non-reference video on congestion
+		std::atomic<Mona::UInt64>	gop; // video until the next keyframe on congestion
+		std::atomic<Mona::UInt64>	ttl; // discarded by SRT (too late)
+		std::atomic<Mona::UInt64>	errors; // refused by SRT
+	};
+
+	static const Mona::UInt32 DROP_GOP_TIMEOUT = 5000; // ms of video dropping on congestion before resuming without keyframe
+
+	SRTSender(const Options& options, const Mona::shared<SRTStats::Series>& pStats = nullptr);
+
+	// Send a payload of at most 1316 bytes, return false if the payload is dropped
+	// Single producer: always called from the same thread (or serialized)
+	bool write(const TSPacker::Payload& payload);
+	// Producer thread, send the cached GOP first if the socket has just been connected
+	void join(const std::deque<TSPacker::Payload>& gop);
+
+	bool connected() const { return _connectedSocket != ::SRT_INVALID_SOCK; }
+	Congestion congestion() const { return Congestion(_congestion.load()); }
+	const Drops& drops() const { return _drops; }
+	// Duration of write() calls in microseconds
+	const Histogram& writeLatency() const { return _writeLatency; }
+	// Time in microseconds a payload has been held by the pacer
+	const Histogram& pacingDelay() const { return _pacingDelay; }
+
+	const Mona::shared<SRTStats::Series>	pStats; // sampled by the reactor, can be null
+
+protected:
+	// Send the queued payloads until the SRT sending buffer is full (or drop them if disconnected),
+	// nothing is done if another thread is already sending
+	void flush();
+	// Reactor thread, the socket becomes the connected one and waits the cached GOP
+	void activate(::SRTSOCKET socket);
+	// Reactor thread, the socket becomes the connected one on the next keyframe written (SRT_INVALID_SOCK cancels)
+	void switchTo(::SRTSOCKET socket) { _switching.store(socket, std::memory_order_release); }
+	::SRTSOCKET switching() const { return _switching.load(std::memory_order_acquire); }
+	// Reactor thread, update the congestion level from the SRT sending buffer and the queue occupancy, and sample the stats
+	void control(Mona::Int64 now);
+	// Reactor thread, last RTT measured in ms and bitrate written in bytes/s, 0 until measured
+	double rtt() const { return _rtt; }
+	Mona::Int64 bitrate() const { return _bitrate; }
+
+	const Options					_options;
+
+	std::atomic<::SRTSOCKET>	_connectedSocket; // valid only once connected
+	std::atomic<::SRTSOCKET>	_switching; // connected socket on the next keyframe
+
+private:
+	// Producer thread, return true if the payload has to be dropped for congestion
+	bool congested(const TSPacker::Payload& payload);
+	// Copy to queue, with its queuing time if latencies are measured
+	static TSPacker::Payload Stamp(const TSPacker::Payload& payload);
+	// Reactor thread, measure the bitrate written every second for the pacer and the auto tuning (SRTO_INPUTBW)
+	void measure(::SRTSOCKET socket, Mona::Int64 now);
+	// Sending thread, return false if the payload has to wait for tokens
+	bool pace(const TSPacker::Payload& payload);
+	// Sending thread, srctime of a payload: its source time (or now), never in the future, before the socket activation or decreasing
+	Mona::Int64 sourceTime(const TSPacker::Payload& payload);
+	std::atomic<bool>				_joining; // connected but cached GOP not sent yet
+	std::atomic<bool>				_sending; // owned by the thread which consumes the queue
+	SPSCQueue<TSPacker::Payload>	_queue;
+	std::atomic<Mona::UInt8>		_congestion;
+	Drops							_drops;
+	Histogram						_writeLatency;
+	std::atomic<Mona::UInt64>		_bytes; // written, dropped or not
+	std::atomic<Mona::UInt32>		_queuedBytes;
+	std::atomic<Mona::Int64>		_pacingRate; // bytes/s, 0 until measured
+	std::atomic<Mona::UInt64>		_pacedMax; // maximum pacing delay in microseconds since the last stats sample
+	std::atomic<Mona::Int64>		_startTime; // srt_time_now of the socket activation
+	Histogram						_pacingDelay;
+
+	// members used by the sending thread
+	Mona::Int64						_tokens; // bytes
+	std::chrono::steady_clock::time_point	_tokensTime;
+	std::chrono::steady_clock::time_point	_pacedTime; // first time the queue head was paced
+	bool							_paced;
+	Mona::Int64						_srcTime; // last srctime sent
+	Mona::Int64						_srcStart; // _startTime of the socket of _srcTime
+	std::chrono::steady_clock::time_point	_errorTime; // last send error logged
+
+	// members used by reactor thread
+	double							_rtt;
+	Mona::Int64						_bitrate; // smoothed
+	Mona::Int64						_inputBW; // set on the connected socket
+	Mona::Int64						_rateTime;
+	Mona::UInt64					_rateBytes;
+
+	// members used by producer thread
+	bool							_droppingGOP; // dropping video until the next keyframe
+	std::chrono::steady_clock::time_point	_droppingTime; // start of the video dropping
+};
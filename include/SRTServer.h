@@ -0,0 +1,112 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "SRTSender.h"
+#include "TSMux.h"
+#include "Mona/ServerAPI.h"
+#include "Mona/Subscription.h"
+
+/*!
+SRT listener output: decoders connect with a streamid naming a publication (raw or "#!::r=name"),
+each publication is subscribed and TS muxed once, its payloads are shared by reference between all its SRT subscribers.
+The listening and subscriber sockets are handled by a SRTRuntime reactor */
+struct SRTServer : virtual Mona::Object {
+	SRTServer(const Mona::Parameters& configs, Mona::ServerAPI& api, SRTRuntime& runtime, SRTStats& stats);
+	virtual ~SRTServer();
+
+	bool start();
+	void stop();
+
+private:
+	// Accepted SRT socket, connected since its creation
+	struct Subscriber : SRTSender, virtual Mona::Object {
+		Subscriber(const Options& options, const Mona::shared<SRTStats::Series>& pStats, ::SRTSOCKET socket, const std::string& name) : SRTSender(options, pStats), socket(socket), name(name) { activate(socket); }
+
+		// Reactor thread
+		void send(Mona::Int64 now) { control(now); flush(); }
+		void close();
+
+		const ::SRTSOCKET	socket;
+		const std::string	name;
+	};
+	typedef std::vector<Mona::shared<Subscriber>> Subscribers;
+
+	// Listening socket and its subscribers (reactor thread)
+	struct Listener : SRTRuntime::Socket, virtual Mona::Object {
+		Listener(SRTServer& server, const Mona::SocketAddress& address);
+
+		const Mona::SocketAddress	address;
+
+	private:
+		void onManage(SRTRuntime::Reactor& reactor, Mona::Int64 now);
+		void onReadable(SRTRuntime::Reactor& reactor, ::SRTSOCKET socket);
+		void onClose(SRTRuntime::Reactor& reactor);
+
+		bool listen(SRTRuntime::Reactor& reactor);
+		void accept(SRTRuntime::Reactor& reactor);
+		void close(SRTRuntime::Reactor& reactor, const Mona::shared<Subscriber>& pSubscriber);
+
+		const Mona::Handler&								_handler;
+		SRTStats&											_stats;
+		int													_backlog;
+		const SRTSender::Options							_options;
+		::SRTSOCKET											_socket;
+		std::map<::SRTSOCKET, Mona::shared<Subscriber>>		_subscribers;
+		Mona::Event<void(Mona::shared<Subscriber>&)>		_onSubscribe;
+		Mona::Event<void(Mona::shared<Subscriber>&)>		_onUnsubscribe;
+	};
+
+	// A subscribed publication muxed for all its subscribers (main thread)
+	struct Feed : Mona::Media::Target, virtual Mona::Object {
+		Feed(Mona::ServerAPI& api, Mona::UInt32 holdDelay, Mona::UInt32 frameQueue, Mona::UInt32 gopCache, Mona::UInt32 configInterval, Mona::UInt32 sourceDrift);
+		~Feed();
+
+		void add(const Mona::shared<Subscriber>& pSubscriber);
+		// Return false once there is no more subscriber
+		bool remove(const Mona::shared<Subscriber>& pSubscriber);
+
+		Mona::Subscription		subscription;
+
+	private:
+		bool writeAudio(Mona::UInt16 track, const Mona::Media::Audio::Tag& tag, const Mona::Packet& packet, bool reliable);
+		bool writeVideo(Mona::UInt16 track, const Mona::Media::Video::Tag& tag, const Mona::Packet& packet, bool reliable);
+		void endMedia();
+
+		Mona::ServerAPI&					_api;
+		Mona::UInt32						_holdDelay;
+		Mona::Timer::OnTimer				_onFlush;
+		Mona::shared<TSMux>					_pMux;
+		// Copy-on-write list, the muxing thread reads a snapshot with std::atomic_load
+		Mona::shared<Mona::shared<const Subscribers>>	_ppSubscribers;
+	};
+
+	Mona::ServerAPI&							_api;
+	SRTRuntime&									_runtime;
+	SRTStats&									_stats;
+	std::string									_host;
+	int											_backlog;
+	SRTSender::Options							_options;
+	Mona::UInt32								_holdDelay;
+	Mona::UInt32								_frameQueue;
+	Mona::UInt32								_gopCache;
+	Mona::UInt32								_configInterval;
+	bool										_started;
+	Mona::shared<Listener>						_pListener;
+	std::map<std::string, Mona::unique<Feed>>	_feeds; // subscribed publications by name
+	Mona::Event<void(Mona::shared<Subscriber>&)>	_onSubscribe; // main thread
+	Mona::Event<void(Mona::shared<Subscriber>&)>	_onUnsubscribe; // main thread
+};
@@ -0,0 +1,126 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "SRTRuntime.h"
+#include "TSInspector.h"
+#include "Histogram.h"
+
+/*!
+SRT statistics of every socket: each socket owner samples srt_bstats periodically into its own lock-free ring
+(one writer thread per series), the main thread exports all the series as JSON and Prometheus text */
+struct SRTStats : virtual Mona::Object {
+	struct Sample {
+		Sample() : time(0), rtt(0), sendRate(0), recvRate(0), sent(0), received(0), sendLoss(0), recvLoss(0), retransmitted(0),
+			sendLossRate(0), recvLossRate(0), sendDrop(0), recvDrop(0), sendBuffer(0), recvBuffer(0), dropped(0), pacing(0), delivery(0), deliveryJitter(0) {}
+
+		Mona::Int64		time;
+		double			rtt; // ms
+		double			sendRate; // Mbps since the previous sample
+		double			recvRate; // Mbps since the previous sample
+		Mona::UInt64	sent; // packets since connection
+		Mona::UInt64	received;
+		Mona::UInt32	sendLoss;
+		Mona::UInt32	recvLoss;
+		Mona::UInt32	retransmitted;
+		double			sendLossRate; // % of the packets sent lost since the previous sample
+		double			recvLossRate; // % of the packets to receive lost since the previous sample
+		Mona::UInt32	sendDrop; // dropped by SRT (too late)
+		Mona::UInt32	recvDrop;
+		Mona::Int32		sendBuffer; // ms of data in the sending buffer
+		Mona::Int32		recvBuffer; // ms of data in the receiving buffer
+		Mona::UInt64	dropped; // payloads dropped before reaching SRT (congestion, queue full...)
+		double			pacing; // ms, maximum time a payload has been held by the pacer since the previous sample (outputs)
+		double			delivery; // ms, 99th percentile of the delivery delay since the connection: reading time after the TSBPD delivery time (callers)
+		double			deliveryJitter; // ms, smoothed delivery delay variation (callers)
+		TSInspector::Health	ts; // received TS analysis (callers)
+	};
+
+	/*!
+	Time series of one socket, written by its owner thread and read by the main thread */
+	struct Series : virtual Mona::Object {
+		Series(Mona::UInt32 id, const std::string& name, const char* type, Mona::UInt32 period, Mona::UInt32 capacity);
+
+		// Writer thread, true if the period is elapsed since the last sample
+		bool due(Mona::Int64 now) const { return (now - _time) >= period; }
+		// Writer thread, add a sample from the SRT stats (never cleared: the rates are computed from the totals of the previous sample)
+		void sample(const ::SRT_TRACEBSTATS& stats, Mona::Int64 now, Mona::UInt64 dropped = 0, const TSInspector::Health* pHealth = NULL, double pacing = 0);
+		// Writer thread, sample the socket if due
+		void sample(::SRTSOCKET socket, Mona::Int64 now, Mona::UInt64 dropped = 0, const TSInspector::Health* pHealth = NULL);
+
+		// Any thread, copy the last samples (the oldest first), return the number of samples read
+		Mona::UInt32 read(std::vector<Sample>& samples, Mona::UInt32 count) const;
+
+		const Mona::UInt32	id; // unique, several series can share a name (reconnections, relays...)
+		const std::string	name;
+		const std::string	type; // "caller", "output" or "subscriber"
+		const Mona::UInt32	period;
+		// Writer thread, delivery delay of the received messages after their TSBPD delivery time in microseconds, and its smoothed variation
+		Histogram			delivery;
+		double				deliveryJitter;
+
+	private:
+		// Seqlock slot: odd sequence while written, the reader retries if the sequence has changed
+		struct Slot {
+			Slot() : sequence(0) {}
+			std::atomic<Mona::UInt32>	sequence;
+			Sample						sample;
+		};
+
+		// Totals of the previous sample, reset on a new socket
+		struct Totals {
+			Totals() : time(0), sentBytes(0), recvBytes(0), sent(0), received(0), sendLoss(0), recvLoss(0) {}
+			Mona::Int64		time; // ms since the connection
+			Mona::UInt64	sentBytes;
+			Mona::UInt64	recvBytes;
+			Mona::Int64		sent;
+			Mona::Int64		received;
+			Mona::Int32		sendLoss;
+			Mona::Int32		recvLoss;
+		};
+
+		std::vector<Slot>			_slots;
+		std::atomic<Mona::UInt32>	_count;
+		Mona::Int64					_time;
+		Totals						_totals;
+	};
+
+	SRTStats(const Mona::Parameters& configs);
+
+	// Thread-safe, register a new series
+	Mona::shared<Series> add(const std::string& name, const char* type);
+	void remove(const Mona::shared<Series>& pSeries);
+
+	// Any thread, last "history" samples of each series
+	std::string& writeJSON(std::string& out, Mona::UInt32 history = 1) const;
+	std::string& writePrometheus(std::string& out) const;
+
+	// Main thread, export "stats.json" and "metrics" files in the www directory (served by the HTTP server)
+	void manage(const std::string& www);
+
+	const Mona::UInt32	period; // ms between two samples
+	const Mona::UInt32	history; // samples kept by series
+
+private:
+	static std::string Escape(const std::string& value);
+	static void WriteFile(const std::string& path, const std::string& content);
+
+	mutable std::mutex					_mutex;
+	std::set<Mona::shared<Series>>		_series;
+	Mona::UInt32						_nextId;
+	Mona::UInt32						_exportHistory; // samples by series in stats.json
+	bool								_export;
+};
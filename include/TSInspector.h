@@ -0,0 +1,89 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include "TSPacker.h"
+
+/*!
+Inline TS analyzer of the received messages, used for the SRTIn health monitoring and the relay without demux:
+- TSPacker flags of every message (tables, audio, video, random access point) from the PAT and PMT parsed
+- TR 101 290 style priority 1 and 2 counters: sync, continuity, PAT/PMT repetition and CRC, PID presence, PCR repetition and jitter.
+The headers are checked by vectors of packets (AVX2 when compiled with -mavx2, SSE2, or scalar fallback),
+the per-PID state is then updated only where the headers require it */
+struct TSInspector : virtual Mona::Object {
+	struct Health {
+		Health() : packets(0), syncLoss(0), syncErrors(0), patErrors(0), continuityErrors(0), pmtErrors(0), pidErrors(0),
+			transportErrors(0), crcErrors(0), pcrRepetitionErrors(0), pcrDiscontinuityErrors(0), pcrJitter(0) {}
+
+		Mona::UInt32 errors() const { return syncLoss + syncErrors + patErrors + continuityErrors + pmtErrors + pidErrors + transportErrors + crcErrors + pcrRepetitionErrors + pcrDiscontinuityErrors; }
+
+		Mona::UInt64	packets;
+		// priority 1
+		Mona::UInt32	syncLoss; // messages not aligned on TS packets, resynchronized
+		Mona::UInt32	syncErrors; // packets not starting with 0x47
+		Mona::UInt32	patErrors; // PAT missing for more than 500ms, or invalid
+		Mona::UInt32	continuityErrors;
+		Mona::UInt32	pmtErrors; // PMT missing for more than 500ms, or invalid
+		Mona::UInt32	pidErrors; // PID of the PMT missing for more than 5s
+		// priority 2
+		Mona::UInt32	transportErrors; // transport_error_indicator set
+		Mona::UInt32	crcErrors; // PAT or PMT with a wrong CRC
+		Mona::UInt32	pcrRepetitionErrors; // more than 40ms between two PCR
+		Mona::UInt32	pcrDiscontinuityErrors; // PCR going back or jumping more than 100ms without discontinuity_indicator
+		Mona::UInt32	pcrJitter; // smoothed difference in us between the PCR and the reception intervals
+	};
+
+	TSInspector();
+
+	// Return the TSPacker flags of the TS packets of the message, FLAG_KEY when a video random access point starts there
+	Mona::UInt8 inspect(const Mona::UInt8* data, Mona::UInt32 size);
+	// Periodic checks of the tables and PID presence, to call regularly
+	void check();
+
+	const Health& health() const { return _health; }
+
+private:
+	enum Kind : Mona::UInt8 {
+		KIND_UNKNOWN = 0,
+		KIND_PSI,
+		KIND_AUDIO,
+		KIND_VIDEO,
+		KIND_SEEN = 0x80 // packet received since the last PID check
+	};
+	// Per-PID analysis of a packet whose sync byte is valid
+	Mona::UInt8 inspect(const Mona::UInt8* packet, bool adaptation, Mona::Int64 now);
+	// Section of a table in one TS packet, NULL if incomplete or with a wrong CRC
+	const Mona::UInt8* readSection(const Mona::UInt8* payload, Mona::UInt32 size, Mona::UInt8 tableId, Mona::UInt32& length);
+	void readPAT(const Mona::UInt8* data, Mona::UInt32 size, Mona::Int64 now);
+	void readPMT(const Mona::UInt8* data, Mona::UInt32 size, Mona::Int64 now);
+	void readPCR(const Mona::UInt8* packet, Mona::Int64 now);
+
+	static Mona::Int64 Now() { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+	Health					_health;
+	Mona::UInt8				_kinds[0x2000]; // Kind by PID
+	Mona::UInt8				_counters[0x2000]; // last continuity counter by PID, 0xFF if unknown
+	Mona::UInt16			_pmtPID; // 0 until the PAT is read
+	Mona::UInt16			_pcrPID; // 0x1FFF until the PMT is read
+	std::vector<Mona::UInt16>	_esPIDs; // elementary streams of the PMT
+	// times in us
+	Mona::Int64				_patTime;
+	Mona::Int64				_pmtTime;
+	Mona::Int64				_pidTime; // last PID presence check
+	Mona::Int64				_pcr; // last PCR in us, -1 if unknown
+	Mona::Int64				_pcrTime; // reception of the last PCR
+};
@@ -0,0 +1,135 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include "Mona/Media.h"
+#include "Mona/ThreadPool.h"
+#include "Mona/TSWriter.h"
+#include "SPSCQueue.h"
+#include "TSPacker.h"
+#include "Latency.h"
+
+/*!
+TS muxer of one publication, frames are pushed from the main thread through a lock-free queue
+and muxed on a worker thread of the server pool, always the same one for a given muxer.
+onPayload is raised on this worker thread with the SRT payloads to send.
+The payloads sent since the last keyframe (with its codec infos) are kept to start the new outputs on it.
+The program tables and H264 codec infos are muxed once by codec change, then spliced from this cache on keyframes
+(every keyframe, or at most every configInterval ms) with their timestamps and continuity counters patched,
+on the other keyframes a patched copy is only put at the start of the GOP cache for the new outputs.
+The payloads are timed with the media timestamps mapped on the libsrt clock */
+struct TSMux : std::enable_shared_from_this<TSMux>, virtual Mona::Object {
+	typedef Mona::Event<void(const TSPacker::Payload& payload)> ON(Payload);
+
+	TSMux(Mona::ThreadPool& threadPool, Mona::UInt32 holdDelay, Mona::UInt32 queueSize = 1024, Mona::UInt32 gopCache = 0x400000, Mona::UInt32 configInterval = 0, Mona::UInt32 sourceDrift = 60);
+
+	// Main thread, return false if the frame is dropped (queue full)
+	bool writeAudio(Mona::UInt16 track, const Mona::Media::Audio::Tag& tag, const Mona::Packet& packet);
+	bool writeVideo(Mona::UInt16 track, const Mona::Media::Video::Tag& tag, const Mona::Packet& packet);
+	// Main thread, send the partial payload if it has reached the hold delay
+	void flush();
+	// Main thread, end of the media (reset the TS writer and codecs)
+	void reset();
+
+	// Worker thread (onPayload), payloads already sent of the current GOP, empty if bigger than gopCache
+	const std::deque<TSPacker::Payload>& gop() const { return _gop; }
+
+	const Mona::UInt32 holdDelay; // maximum time in ms before sending a partial payload
+	const Mona::UInt32 gopCache; // maximum size in bytes of the GOP cache, 0 to disable it
+	const Mona::UInt32 configInterval; // minimum time in ms between two codec infos sent on keyframes, 0 for every keyframe
+	const Mona::UInt32 sourceDrift; // maximum lag in ms of the source times behind the real time, see SRTSender::Options::sourceDrift
+
+private:
+	struct Frame : virtual Mona::Object {
+		enum Type : Mona::UInt8 {
+			TYPE_FLUSH = 0,
+			TYPE_AUDIO,
+			TYPE_VIDEO,
+			TYPE_RESET
+		};
+		Frame(Type type = TYPE_FLUSH) : type(type), track(0) {}
+		Frame(Mona::UInt16 track, const Mona::Media::Audio::Tag& tag, const Mona::Packet& packet) : type(TYPE_AUDIO), track(track), audio(tag), packet(packet) { LATENCY_STAMP(stamp); }
+		Frame(Mona::UInt16 track, const Mona::Media::Video::Tag& tag, const Mona::Packet& packet) : type(TYPE_VIDEO), track(track), video(tag), packet(packet) { LATENCY_STAMP(stamp); }
+
+		Type						type;
+		Mona::UInt16				track;
+		Mona::Media::Audio::Tag		audio;
+		Mona::Media::Video::Tag		video;
+		Mona::Packet				packet;
+		LATENCY_FIELD(stamp); // reception time
+	};
+	struct Muxing : Mona::Runner, virtual Mona::Object {
+		Muxing(const Mona::shared<TSMux>& pMux) : Mona::Runner("TSMux"), _pMux(pMux) {}
+	private:
+		bool run(Mona::Exception& ex) { _pMux->process(); return true; }
+		Mona::shared<TSMux> _pMux;
+	};
+
+	bool push(Frame&& frame);
+
+	// Worker thread
+	void process();
+	void writeAudio(const Mona::Media::Audio::Tag& tag, const Mona::Packet& packet);
+	void writeVideo(const Mona::Media::Video::Tag& tag, const Mona::Packet& packet);
+	// Push the current frame into the TS writer, its TS packets are packed into SRT payloads
+	void writeFrame(const Mona::Media::Audio::Tag& tag, const Mona::Packet& packet);
+	void writeFrame(const Mona::Media::Video::Tag& tag, const Mona::Packet& packet);
+	void beginMedia();
+	// Codec infos of a keyframe: muxed and cached the first time, then spliced from the cache
+	void writeConfig(const Mona::Media::Video::Tag& tag);
+	// Pack the cached codec infos with the timestamps of the first TS packet of the keyframe
+	void spliceConfig(const Mona::Packet& keyframe);
+	// Put a copy of the codec infos, timed on the keyframe, at the start of the GOP cache without sending it
+	void cacheConfig(const Mona::Packet& keyframe);
+	// Patch the timestamps of the codec infos with the ones of the first TS packet of the keyframe
+	void timeConfig(const Mona::Packet& keyframe);
+	void resetConfig();
+	// Non-reference video frame which can be dropped without breaking the decoding of the next frames
+	static bool IsDisposable(const Mona::Media::Video::Tag& tag, const Mona::Packet& packet);
+	// Flush the partial payload if it has reached the hold delay
+	void holdPayload();
+	// Start a new GOP cache on a keyframe, the keyframe starts a new payload
+	void beginGOP();
+	void cache(const TSPacker::Payload& payload);
+	// Source time in microseconds on the libsrt clock of a media time in ms, anchored on the earliest frame (again if the media lags by more than sourceDrift)
+	Mona::Int64 sourceTime(Mona::UInt32 time);
+
+	Mona::ThreadPool&			_threadPool;
+	Mona::UInt16				_track; // worker thread of this muxer
+	SPSCQueue<Frame>			_frames;
+	std::atomic<bool>			_scheduled;
+	Mona::UInt32				_dropped;
+
+	// members used by worker thread
+	Mona::TSWriter				_tsWriter;
+	TSPacker					_tsPacker;
+	Mona::Packet				_videoCodec; // video codec to be saved
+	bool						_videoCodecSent;
+	Mona::Buffer				_psiTS; // program tables written by beginMedia
+	Mona::Buffer				_configTS; // program tables and video codec infos muxed, without PCR
+	bool						_capturing; // video codec infos being muxed into _configTS
+	bool						_splicing; // _configTS to splice before the next video TS packets
+	bool						_caching; // _configTS to cache before the next video TS packets
+	Mona::Int64					_configTime; // time of the last codec infos sent
+	Mona::Packet				_audioCodec; // audio codec to be saved
+	bool						_audioCodecSent;
+	bool						_first; // To write the TS header when the first packet is written
+	std::deque<TSPacker::Payload>	_gop;
+	bool						_gopStart; // next video frame starts the GOP
+	Mona::UInt32				_gopSize; // bytes cached, -1 if overflowed until the next keyframe
+	Mona::Int64					_srcOrigin; // media time 0 on the libsrt clock in microseconds, 0 before the first frame
+};
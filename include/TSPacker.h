@@ -0,0 +1,80 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include "Mona/Packet.h"
+#include "BufferPool.h"
+#include "Latency.h"
+
+/*!
+Packs the TS packets written by a TSWriter straight into SRT payloads of 7 TS packets,
+packets of consecutive frames and tracks share the same payload until it is full or flushed.
+Payload buffers are recycled through a pool once sent.
+Every payload is flagged with the kinds of TS packets it contains to prioritize it on congestion.
+Continuity counters are rewritten while packing, so TS packets spliced from a cache keep every PID continuous.
+A payload carries the source time of its first timed TS packets, the SRT senders can transmit it as srctime */
+struct TSPacker : virtual Mona::Object {
+	enum Flag : Mona::UInt8 {
+		FLAG_PSI = 1, // program tables
+		FLAG_AUDIO = 2,
+		FLAG_VIDEO = 4, // reference video frame
+		FLAG_DISPOSABLE = 8, // non-reference video frame
+		FLAG_KEY = 16 // start of a GOP (codec infos or keyframe)
+	};
+	struct Payload : Mona::Packet {
+		Payload() : flags(0), time(0) {}
+		Payload(const Mona::Packet& packet, Mona::UInt8 flags, Mona::Int64 time = 0) : Mona::Packet(packet), flags(flags), time(time) {}
+
+		Mona::UInt8 flags;
+		Mona::Int64 time; // origin of the content in microseconds on the libsrt clock (srt_time_now), 0 if unknown
+		LATENCY_FIELD(stamp); // queuing time
+	};
+	typedef Mona::Event<void(const Payload& payload)> ON(Payload);
+
+	static const Mona::UInt32 PAYLOAD_SIZE = 1316; // 7 TS packets, SRT live payload size
+
+	TSPacker(Mona::UInt32 maxPayloads = 256);
+
+	// Append TS packets to the current payload, onPayload is raised for every full payload
+	// FLAG_KEY is kept only for the payload where the packets start, srcTime is the origin of the packets (0 if unknown)
+	void write(const Mona::Packet& packet, Mona::UInt8 flags, Mona::Int64 srcTime = 0);
+	// Raise onPayload with the current payload if not empty
+	void flush();
+
+	// Time at which the current partial payload has been started, 0 if there is no partial payload
+	Mona::Int64 time() const { return _pBuffer && _pBuffer->size() ? _time : 0; }
+	// Part of the payloads capacity used by TS packets, 1 when all the payloads are full
+	double fillRatio() const { return _payloads ? double(_bytes) / (_payloads * PAYLOAD_SIZE) : 1; }
+
+	// Last continuity counter written on the PID
+	Mona::UInt8 counter(Mona::UInt16 pid) const { return _counters[pid & 0x1FFF]; }
+
+	Mona::UInt64 payloads() const { return _payloads; }
+	Mona::UInt64 bytes() const { return _bytes; }
+	const BufferPool& pool() const { return _pool; }
+
+private:
+	BufferPool					_pool;
+	Mona::shared<Mona::Buffer>	_pBuffer;
+	Mona::Int64					_time;
+	Mona::UInt8					_flags; // flags of the current payload
+	Mona::Int64					_srcTime; // source time of the current payload
+	Mona::UInt8					_counters[0x2000]; // last continuity counter by PID
+	LATENCY_FIELD(_stamp); // start of the current payload
+	Mona::UInt64				_payloads;
+	Mona::UInt64				_bytes;
+};
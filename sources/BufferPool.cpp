@@ -0,0 +1,60 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "BufferPool.h"
+
+using namespace Mona;
+using namespace std;
+
+BufferPool::BufferPool(UInt32 bufferSize, UInt32 maxBuffers) : bufferSize(bufferSize), _pSlab(new Slab(maxBuffers)), _hits(0), _misses(0) {
+	_pSlab->buffers.reserve(maxBuffers);
+}
+
+shared<Buffer> BufferPool::acquire() {
+	Buffer* pBuffer = NULL;
+	{
+		lock_guard<mutex> lock(_pSlab->access);
+		if (!_pSlab->buffers.empty()) {
+			pBuffer = _pSlab->buffers.back();
+			_pSlab->buffers.pop_back();
+		}
+	}
+	if (pBuffer)
+		++_hits;
+	else {
+		++_misses;
+		pBuffer = new Buffer(bufferSize);
+	}
+	pBuffer->clear(); // keep capacity
+
+	shared<Slab> pSlab(_pSlab);
+	return shared<Buffer>(pBuffer, [pSlab](Buffer* pBuffer) { pSlab->release(pBuffer); });
+}
+
+void BufferPool::Slab::release(Buffer* pBuffer) {
+	{
+		lock_guard<mutex> lock(access);
+		if (buffers.size() < maxBuffers) {
+			buffers.emplace_back(pBuffer);
+			return;
+		}
+	}
+	delete pBuffer; // pool full
+}
+
+BufferPool::Slab::~Slab() {
+	for (Buffer* pBuffer : buffers)
+		delete pBuffer;
+}
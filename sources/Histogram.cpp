@@ -0,0 +1,77 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "Histogram.h"
+
+using namespace Mona;
+using namespace std;
+
+Histogram::Histogram() {
+	reset();
+}
+
+void Histogram::reset() {
+	for (UInt32 i = 0; i < BUCKETS; ++i)
+		_buckets[i].store(0, memory_order_relaxed);
+	_count = 0;
+	_max = 0;
+	_sum = 0;
+}
+
+UInt32 Histogram::Index(UInt64 value) {
+	if (value < (1 << SUB_BITS))
+		return UInt32(value); // exact values under 16
+	UInt8 exponent = 63;
+	while (!(value >> exponent))
+		--exponent;
+	exponent -= SUB_BITS;
+	return ((exponent + 1) << SUB_BITS) + UInt32((value >> exponent) & ((1 << SUB_BITS) - 1));
+}
+
+UInt64 Histogram::Value(UInt32 index) {
+	if (index < (1 << SUB_BITS))
+		return index;
+	UInt8 exponent = (index >> SUB_BITS) - 1;
+	return ((UInt64((1 << SUB_BITS) | (index & ((1 << SUB_BITS) - 1))) + 1) << exponent) - 1;
+}
+
+void Histogram::record(UInt64 value) {
+	_buckets[Index(value)].fetch_add(1, memory_order_relaxed);
+	++_count;
+	_sum.fetch_add(value, memory_order_relaxed);
+	UInt64 max = _max.load(memory_order_relaxed);
+	while (value > max && !_max.compare_exchange_weak(max, value, memory_order_relaxed));
+}
+
+UInt64 Histogram::count(UInt64 value) const {
+	UInt64 total = 0;
+	for (UInt32 i = 0; i < BUCKETS && Value(i) <= value; ++i)
+		total += _buckets[i].load(memory_order_relaxed);
+	return total;
+}
+
+UInt64 Histogram::percentile(double ratio) const {
+	UInt64 count = _count;
+	if (!count)
+		return 0;
+	UInt64 rank = UInt64(ratio * count + 0.5);
+	UInt64 total = 0;
+	for (UInt32 i = 0; i < BUCKETS; ++i) {
+		total += _buckets[i].load(memory_order_relaxed);
+		if (total >= rank && total)
+			return std::min<UInt64>(Value(i), _max);
+	}
+	return _max;
+}
@@ -0,0 +1,65 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "Latency.h"
+#include "Mona/Logs.h"
+#include "Mona/String.h"
+
+using namespace Mona;
+using namespace std;
+
+static const char* const StageNames[] = { "muxQueue", "mux", "payload", "sendQueue", "send", "batch", "handler", "demux" };
+
+bool Latency::Enabled() {
+#if defined(SRT_LATENCY)
+	return true;
+#else
+	return false;
+#endif
+}
+
+Histogram* Latency::Histograms() {
+	static Histogram histograms[STAGES];
+	return histograms;
+}
+
+string& Latency::WriteJSON(string& out) {
+	out += '{';
+	if (Enabled()) {
+		for (UInt8 stage = 0; stage < STAGES; ++stage) {
+			const Histogram& histogram = Histograms()[stage];
+			String::Append(out, stage ? "," : "", "\"", StageNames[stage], "\":{\"count\":", histogram.count(), ",\"p50\":", histogram.percentile(0.5),
+				",\"p90\":", histogram.percentile(0.9), ",\"p99\":", histogram.percentile(0.99), ",\"p999\":", histogram.percentile(0.999), ",\"max\":", histogram.max(), "}");
+		}
+	}
+	out += '}';
+	return out;
+}
+
+void Latency::Log() {
+	if (!Enabled())
+		return;
+	for (UInt8 stage = 0; stage < STAGES; ++stage) {
+		const Histogram& histogram = Histograms()[stage];
+		if (histogram.count())
+			INFO("Latency ", StageNames[stage], ": ", histogram.count(), " samples, p50 ", histogram.percentile(0.5), "us, p99 ", histogram.percentile(0.99),
+				"us, p99.9 ", histogram.percentile(0.999), "us, max ", histogram.max(), "us")
+	}
+}
+
+void Latency::Reset() {
+	for (UInt8 stage = 0; stage < STAGES; ++stage)
+		Histograms()[stage].reset();
+}
@@ -14,6 +14,9 @@
 */
 
 #include "SRTIn.h"
+#include "SRTServer.h"
+#include "SRTStats.h"
+#include "Latency.h"
 
 #include "MonaSRT.h"
 #include "OutputApp.h"
@@ -31,11 +34,19 @@ namespace Mona {
 //// Server Events /////
 void MonaSRT::onStart() {
 
-	_applications["/srt"] = new OutputApp(*this);
+	_srtStats = new SRTStats(*this);
+	_srtRuntime = new SRTRuntime(*this);
+	_srtRuntime->start();
+
+	_applications["/srt"] = new OutputApp(*this, *this, *_srtRuntime, *_srtStats);
 	if (getBoolean<false>("SRT")) {
-		_srtIn = new SRTIn(*this, *this);
+		_srtIn = new SRTIn(*this, *this, *_srtRuntime, *_srtStats);
 		_srtIn->load();
 	}
+	if (*getString("srt.listen", "")) {
+		_srtServer = new SRTServer(*this, *this, *_srtRuntime, *_srtStats);
+		_srtServer->start();
+	}
 }
 
 void MonaSRT::manage() {
@@ -43,6 +54,10 @@ void MonaSRT::manage() {
 	// manage application!
 	for (auto& it : _applications)
 		it.second->manage();
+
+	// export SRT statistics
+	if (_srtStats)
+		_srtStats->manage(_wwwPath);
 }
 
 void MonaSRT::onStop() {
@@ -57,6 +72,24 @@ void MonaSRT::onStop() {
 		_srtIn = nullptr;
 	}
 
+	if (_srtServer) {
+		delete _srtServer;
+		_srtServer = nullptr;
+	}
+
+	// SRT library stopped once all the sockets are closed
+	if (_srtRuntime) {
+		delete _srtRuntime;
+		_srtRuntime = nullptr;
+	}
+
+	if (_srtStats) {
+		delete _srtStats;
+		_srtStats = nullptr;
+	}
+
+	Latency::Log();
+
 	// unblock ctrl+c waiting
 	_terminateSignal.set();
 }
@@ -138,14 +171,19 @@ bool MonaSRT::onSubscribe(Exception& ex, const Subscription& subscription, const
 	if (pClient) {
 
 		INFO(pClient->protocol, " ", pClient->address, " subscribe to ", publication.name());
-		if (pClient->hasCustomData())
-			return pClient->getCustomData<App::Client>()->onSubscribe(ex, subscription, publication);
+		if (pClient->hasCustomData() && !pClient->getCustomData<App::Client>()->onSubscribe(ex, subscription, publication))
+			return false;
 	} else
 		INFO("Subscribe to ", publication.name());
+	// SRT relayed publications are demuxed only while subscribed
+	if (_srtIn)
+		_srtIn->onSubscribe(publication);
 	return true; // "true" to allow, "false" to forbid
 } 
 
 void MonaSRT::onUnsubscribe(const Subscription& subscription, const Publication& publication, Client* pClient) {
+	if (_srtIn)
+		_srtIn->onUnsubscribe(publication);
 	if (pClient) {
 		INFO(pClient->protocol, " ", pClient->address, " unsubscribe to ", publication.name());
 		if (pClient->hasCustomData())
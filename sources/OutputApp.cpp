@@ -13,382 +13,71 @@
  * License along with this library; If not, see <http://www.gnu.org/licenses/>
  */
 
-#if defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__) && !defined(WIN32)
-	#define WIN32
-#endif
-#include <srt/srt.h>
-#undef LOG_INFO
-#undef LOG_DEBUG
-#undef min
-#undef max
-
 #include "OutputApp.h"
 #include "Mona/String.h"
-#include "Mona/AVC.h"
-#include "Mona/SocketAddress.h"
-#include "Mona/Thread.h"
+#include "Latency.h"
 
 using namespace Mona;
 using namespace std;
 
-static const int64_t epollWaitTimoutMS = 250;
-static const int64_t reconnectPeriodMS = 1000;
-
-class OutputApp::Client::OpenSrtPIMPL : private Thread {
-	private:
-		::SRTSOCKET _socket;
-		bool _started;
-		string _host;
-		std::mutex _mutex;
-	public:
-		OpenSrtPIMPL() :
-			_socket(::SRT_INVALID_SOCK), _started(false), Thread("OutputApp") {
-		}
-		~OpenSrtPIMPL() {
-			Close();
-		}
-
-		bool Open(const string& host) {
-			if (_started) {
-				ERROR("SRT Open: Already open, please close first")
-				return false;
-			}
-
-			if (::srt_startup()) {
-				ERROR("SRT Open: Error starting SRT library")
-				return false;
-			}
-			_started = true;
-			_host = host;
-
-			::srt_setloghandler(nullptr, logCallback);
-			::srt_setloglevel(0xff);
-
-			Thread::start();
-
-			INFO("SRT opened")
-
-			return true;
-		}
-
-		void Close() {
-			Disconnect();
-			Thread::stop();
-
-			if (_started) {
-				::srt_setloghandler(nullptr, nullptr);
-				::srt_cleanup();
-				_started = false;
-				_host.clear();
-			}
-		}
-
-		bool Connect() {
-			std::lock_guard<std::mutex> lock(_mutex);
-			return ConnectActual();
-		}
-
-		bool ConnectActual() {
-			SocketAddress addr;
-
-			Exception ex;
-			if (!addr.set(ex, _host) || addr.family() != IPAddress::IPv4) {
-				ERROR("SRT Open: can't resolve target host, ", _host)
-				return false;
-			}
-			
-			if (_socket != ::SRT_INVALID_SOCK) {
-				ERROR("Already connected, please disconnect first")
-				return false;
-			}
-
-			_socket = ::srt_socket(AF_INET, SOCK_DGRAM, 0);
-			if (_socket == ::SRT_INVALID_SOCK ) {
-				ERROR("SRT create socket: ", ::srt_getlasterror_str());
-				return false;
-			}
-
-			bool block = false;
-			int rc = ::srt_setsockopt(_socket, 0, SRTO_SNDSYN, &block, sizeof(block));
-			if (rc != 0)
-			{
-				ERROR("SRT SRTO_SNDSYN: ", ::srt_getlasterror_str());
-				DisconnectActual();
-				return false;
-			}
-			rc = ::srt_setsockopt(_socket, 0, SRTO_RCVSYN, &block, sizeof(block));
-			if (rc != 0)
-			{
-				ERROR("SRT SRTO_RCVSYN: ", ::srt_getlasterror_str());
-				DisconnectActual();
-				return false;
-			}
-
-			int opt = 1;
-			::srt_setsockflag(_socket, ::SRTO_SENDER, &opt, sizeof opt);
-
-			::SRT_SOCKSTATUS state = ::srt_getsockstate(_socket);
-			if (state != SRTS_INIT) {
-				ERROR("SRT Connect: socket is in bad state; ", state)
-				DisconnectActual();
-				return false;
-			}
-
-			INFO("Connecting to ", addr.host(), " port ", addr.port())
-
-			// SRT support only IPV4 so we convert to a sockaddr_in
-			sockaddr soaddr;
-			memcpy(&soaddr, addr.data(), sizeof(sockaddr)); // WARN: work only with ipv4 addresses
-			soaddr.sa_family = AF_INET;
-			if (::srt_connect(_socket, &soaddr, sizeof(sockaddr))) {
-				ERROR("SRT Connect: ", ::srt_getlasterror_str());
-				DisconnectActual();
-				return false;
-			}
-
-			INFO("SRT connect state; ", ::srt_getsockstate(_socket));
-
-			return true;
-		}
-
-		bool Disconnect() {
-			std::lock_guard<std::mutex> lock(_mutex);
-			return DisconnectActual();
-		}
-
-		bool DisconnectActual() {
-			if (_socket != ::SRT_INVALID_SOCK) {
-				::srt_close(_socket);
-
-				INFO("SRT disconnect state; ", ::srt_getsockstate(_socket));
-
-				_socket = ::SRT_INVALID_SOCK;
-			}
-
-			return true;
-		}
-
-		int Write(shared_ptr<Buffer>& pBuffer)
-		{
-			std::lock_guard<std::mutex> lock(_mutex);
-
-			UInt8* p = pBuffer->data();
-			const size_t psize = pBuffer->size();
-
-			if (_socket == ::SRT_INVALID_SOCK) {
-				if ((false)) {
-					DEBUG("SRT: Drop packet while NOT CONNECTED")
-				}
-				return psize;
-			}
-
-			SRT_SOCKSTATUS state = ::srt_getsockstate(_socket);
-			switch(state) {
-				case ::SRTS_CONNECTED: {
-					// No-op
-				}
-				break;
-				default: {
-					if ((false)) {
-						DEBUG("SRT: Drop packet on state ", state)
-					}
-					return psize;
-				}
-				break;
-			}
-
-			for (size_t i = 0; i < psize;) {
-				size_t chunk = min<size_t>(psize - i, (size_t)1316);
-				if (::srt_sendmsg(_socket,
-						(const char*)(p + i), chunk, -1, true) < 0)
-					WARN("SRT: send error; ", ::srt_getlasterror_str())
-				i += chunk;
-			}
-
-			return psize;
-		}
-
-		bool run(Exception&, const volatile bool& requestStop) {
-
-			_mutex.lock();
-
-			int epollid = ::srt_epoll_create();
-			if (epollid < 0) {
-				ERROR("Error initializing UDT epoll set;",
-					::srt_getlasterror_str());
-			}
-
-			while(!requestStop && epollid >= 0) {
-				::SRT_SOCKSTATUS state = ::srt_getsockstate(_socket);
-				if (state == ::SRTS_BROKEN || state == ::SRTS_NONEXIST
-						|| state == ::SRTS_CLOSED) {
-					INFO("Reconnect socket");
-					if (_socket != ::SRT_INVALID_SOCK) {
-						DEBUG("Remove socket from poll; ", (int)_socket);
-						::srt_epoll_remove_usock(epollid, _socket);
-					}
-
-					DisconnectActual();
-					if (!ConnectActual()) {
-
-						ERROR("Error issuing connect");
-
-						// Wait a bit and try again
-						_mutex.unlock();
-						Sleep(reconnectPeriodMS);
-						_mutex.lock();
-						continue;
-					}
-
-					FATAL_CHECK(_socket != ::SRT_INVALID_SOCK)
-					int modes = SRT_EPOLL_IN;
-					if (::srt_epoll_add_usock(epollid, _socket, &modes) != 0) {
-						ERROR("Error adding socket to poll set; ",
-							::srt_getlasterror_str());
-					}
-				}
-
-				_mutex.unlock();
-				const int socksToPoll = 10;
-				int rfdn = socksToPoll;
-				::SRTSOCKET rfds[socksToPoll];
-				int rc = ::srt_epoll_wait(epollid, &rfds[0], &rfdn, nullptr, nullptr,
-					epollWaitTimoutMS, nullptr, nullptr, nullptr, nullptr);
-
-				if (rc <= 0) {
-					// Let the system breath just in case
-					Sleep(0);
-
-					_mutex.lock();
-					continue;
-				}
-				_mutex.lock();
-
-				FATAL_CHECK(rfdn <= socksToPoll)
-
-				for (int i = 0; i < rfdn; i++) {
-					::SRTSOCKET socket = rfds[i];
-					state = ::srt_getsockstate(socket);
-					switch(state) {
-						case ::SRTS_CONNECTED: {
-							// Discard incoming data
-							static char buf[1500];
-							while (::srt_recvmsg(socket, &buf[0], sizeof(buf)) > 0)
-								continue;
-						}
-						break;
-						case ::SRTS_NONEXIST:
-						case ::SRTS_BROKEN:
-						case ::SRTS_CLOSING:
-						case ::SRTS_CLOSED: {
-							DEBUG("Remove socket from poll (on poll event); ", socket);
-							::srt_epoll_remove_usock(epollid, socket);
-						}
-						break;
-						default: {
-							WARN("Unexpected event on ",  socket, "state ", state);
-						}
-						break;
-					}
-				}
-			}
-
-			// TODO: debug this
-			if (epollid > 0)
-				::srt_epoll_release(epollid);
-
-			_mutex.unlock();
-			return true;
-		}
-
-private:
-
-		static void logCallback(void* opaque, int level, const char* file,
-				int line, const char* area, const char* message)
-		{
-			INFO("L:", level, "|", file, "|", line, "|", area, "|", message)
-		}
-};
-
-OutputApp::OutputApp(const Parameters& configs): App(configs)
+OutputApp::OutputApp(const Parameters& configs, ServerAPI& api, SRTRuntime& runtime, SRTStats& stats): App(configs), api(api), runtime(runtime), stats(stats)
 {
-	_target.assign(configs.getString("srt.target", "localhost:4900"));
+	// Comma-separated list of targets, the publication is muxed once and sent to all of them
+	// A target can be an ordered failover list (cdn1:4900|cdn2:4900) and override the transport options with a query (host:port?latency=300...)
+	vector<string> targets;
+	for (string& target : SRTRuntime::Split(configs.getString("srt.target", "localhost:4900"), targets)) {
+		_targets.emplace_back(string(), SRTSender::Options(configs));
+		_targets.back().first = move(_targets.back().second.parse(target));
+	}
+	if (_targets.empty())
+		ERROR("No SRT target configured, RTMP publications will not be forwarded")
+	// The standby shares the output of the first target, its query overrides the options of this output
+	_standby.assign(configs.getString("srt.standby", ""));
+	if (!_targets.empty())
+		_targets.front().second.parse(_standby);
+	_holdDelay = configs.getNumber<UInt32, 5>("srt.holdDelay");
+	_frameQueue = configs.getNumber<UInt32, 1024>("srt.frameQueue");
+	_gopCache = configs.getNumber<UInt32, 0x400000>("srt.gopCache");
+	_configInterval = configs.getNumber<UInt32, 0>("srt.configInterval");
+	// The payloads are shared by all the targets, their source times fit the smallest latency
+	_sourceDrift = SRTSender::Options(configs).sourceDrift();
+	for (const auto& target : _targets)
+		_sourceDrift = min(_sourceDrift, target.second.sourceDrift());
 }
 
 OutputApp::~OutputApp() {
 }
 
-OutputApp::Client::Client(Mona::Client& client, const string& host) : App::Client(client), _first(true), _pPublication(NULL), _videoCodecSent(false), _audioCodecSent(false),
-	_srtPimpl(new OutputApp::Client::OpenSrtPIMPL()) {
-
-	FATAL_CHECK(_srtPimpl.get() != nullptr);
-	_srtPimpl->Open(host);
-
-	_onAudio = [this](UInt16 track, const Media::Audio::Tag& tag, const Packet& packet) {
-		shared<Buffer> pBuffer;
-
-		// AAC codecs to be sent in first
-		if (!_audioCodecSent) {
-			if (tag.codec == Media::Audio::CODEC_AAC && tag.isConfig) {
+OutputApp::Client::Client(Mona::Client& client, OutputApp& app) : App::Client(client), _app(app), _pPublication(NULL),
+	_pMux(new TSMux(app.api.threadPool, app._holdDelay, app._frameQueue, app._gopCache, app._configInterval, app._sourceDrift)) {
 
-				INFO("AAC codec infos saved")
-				_audioCodec.set(std::move(packet));
-			}
-			if (!_audioCodec)
-				return;
+	for (const auto& target : app._targets) {
+		_outputs.emplace_back(new SRTOutput(target.second, target.first, _outputs.empty() ? app._standby : "", app.stats.add(target.first, "output")));
+		_app.runtime.add(_outputs.back());
+	}
 
-			_audioCodecSent = true;
-			INFO("AAC codec infos sent")
-			Media::Audio::Tag configTag(tag);
-			configTag.isConfig = true;
-			configTag.time = tag.time;
-			if (!tag.isConfig && !writePayload(0, writeFrame(pBuffer, configTag, _audioCodec)))
-				return;
+	// Called on the worker thread, it must not reference the client
+	// The payload buffer is shared by reference, each output has its own queue so a slow target can't stall the others
+	// A (re)connected output starts with the cached GOP
+	vector<shared<SRTOutput>> outputs(_outputs);
+	TSMux* pMux(_pMux.get());
+	_pMux->onPayload = [outputs, pMux](const TSPacker::Payload& payload) {
+		for (const shared<SRTOutput>& pOutput : outputs) {
+			pOutput->join(pMux->gop());
+			pOutput->write(payload);
 		}
-
-		if (!writePayload(0, writeFrame(pBuffer, tag, packet))) 
-			return;
+	};
+	_onFlush = [this](UInt32 delay) -> UInt32 {
+		_pMux->flush();
+		return 0;
+	};
+	_onAudio = [this](UInt16 track, const Media::Audio::Tag& tag, const Packet& packet) {
+		if (_pMux->writeAudio(track, tag, packet) && _app._holdDelay)
+			_app.api.timer.set(_onFlush, _app._holdDelay);
 	};
 	_onVideo = [this](UInt16 track, const Media::Video::Tag& tag, const Packet& packet) {
-		shared<Buffer> pBuffer;
-
-		// Video codecs to be sent in first
-		if (!_videoCodecSent) {
-
-			Packet sps, pps;
-			bool isAVCConfig(tag.codec == Media::Video::CODEC_H264 && tag.frame == Media::Video::FRAME_CONFIG && AVC::ParseVideoConfig(packet, sps, pps));
-			if (isAVCConfig) {
-				INFO("Video codec infos saved")
-				_videoCodec.set(std::move(packet));
-			}
-			if (!_videoCodec)
-				return;
-
-			if (tag.frame != Media::Video::FRAME_KEY) {
-				DEBUG("Video frame dropped to wait first key frame")
-				return;
-			}
-
-			_videoCodecSent = true;
-			INFO("Video codec infos sent")
-			Media::Video::Tag configTag(tag);
-			configTag.frame = Media::Video::FRAME_CONFIG;
-			configTag.time = tag.time;
-			if (!isAVCConfig && !writePayload(0, writeFrame(pBuffer, configTag, _videoCodec)))
-				return;
-		}
-		// Send Regularly the codec infos (TODO: Add at timer?)
-		else if (tag.codec == Media::Video::CODEC_H264 && tag.frame == Media::Video::FRAME_KEY) {
-			DEBUG("Sending codec infos")
-			Media::Video::Tag configTag(tag);
-			configTag.frame = Media::Video::FRAME_CONFIG;
-			configTag.time = tag.time;
-			if (!writePayload(0, writeFrame(pBuffer, configTag, _videoCodec)))
-				return;
-		}
-
-		if (!writePayload(0, writeFrame(pBuffer, tag, packet)))
-			return;
+		if (_pMux->writeVideo(track, tag, packet) && _app._holdDelay)
+			_app.api.timer.set(_onFlush, _app._holdDelay);
 	};
 	_onEnd = [this]() {
 		resetSRT();
@@ -399,9 +88,28 @@ OutputApp::Client::Client(Mona::Client& client, const string& host) : App::Clien
 OutputApp::Client::~Client() {
 	INFO("Client from ", client.address, " is disconnecting...")
 
-	_srtPimpl->Close();
-
 	resetSRT();
+
+	for (const shared<SRTOutput>& pOutput : _outputs) {
+		_app.runtime.remove(pOutput);
+		_app.stats.remove(pOutput->pStats);
+	}
+}
+
+bool OutputApp::Client::onInvocation(Exception& ex, const string& name, DataReader& arguments, UInt8 responseType) {
+	// SRT statistics of all the sockets as a JSON string
+	if (name == "getSRTStats") {
+		string json;
+		_app.stats.writeJSON(json, _app.stats.history);
+		client.writer().writeResponse(responseType).writeString(json.data(), json.size());
+	}
+	// Per-stage latency percentiles (empty without SRT_LATENCY)
+	else if (name == "getSRTLatency") {
+		string json;
+		Latency::WriteJSON(json);
+		client.writer().writeResponse(responseType).writeString(json.data(), json.size());
+	}
+	return true;
 }
 
 bool OutputApp::Client::onPublish(Exception& ex, Publication& publication) {
@@ -429,6 +137,7 @@ void OutputApp::Client::onUnpublish(Publication& publication) {
 
 void OutputApp::Client::resetSRT() {
 
+	_app.api.timer.remove(_onFlush);
 	if (_pPublication) {
 		_pPublication->onAudio = nullptr;
 		_pPublication->onVideo = nullptr;
@@ -436,30 +145,10 @@ void OutputApp::Client::resetSRT() {
 		_pPublication = NULL;
 	}
 
-	_tsWriter.endMedia([](const Packet& packet) {}); // reset the ts writer
-	_videoCodec.reset();
-	_audioCodec.reset();
-	_first = false;
-}
-
-template <>
-void OutputApp::Client::writeMedia<Media::Video::Tag>(Mona::BinaryWriter& writer, const Media::Video::Tag& tag, const Mona::Packet& packet) {
-	_tsWriter.writeVideo(0, tag, packet, [&writer](const Packet& output) { writer.write(output); });
-}
-
-template <>
-void OutputApp::Client::writeMedia<Media::Audio::Tag>(Mona::BinaryWriter& writer, const Media::Audio::Tag& tag, const Mona::Packet& packet) {
-	_tsWriter.writeAudio(0, tag, packet, [&writer](const Packet& output) { writer.write(output); });
-}
-
-bool OutputApp::Client::writePayload(UInt16 context, shared_ptr<Buffer>& pBuffer) {
-
-	int res = _srtPimpl->Write(pBuffer);
-
-	return (res == (int)pBuffer->size());
+	_pMux->reset(); // reset the ts writer
 }
 
 OutputApp::Client* OutputApp::newClient(Mona::Exception& ex, Mona::Client& client, Mona::DataReader& parameters, Mona::DataWriter& response) {
 
-	return new Client(client, _target);
+	return new Client(client, *this);
 }
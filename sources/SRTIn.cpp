@@ -16,6 +16,7 @@
 
 
 #include "SRTIn.h"
+#include "Mona/Time.h"
 /*#include "Mona/String.h"
 #include "Mona/AVC.h"
 #include "Mona/SocketAddress.h"*/
@@ -25,17 +26,68 @@ using namespace std;
 
 static const int EpollWaitTimoutMS = 250;
 static const int TSChunkSize = 1316;
-
-SRTIn::SRTIn(const Parameters& configs, ServerAPI& api): Thread("SRTIn"), _api(api), _started(false), _socket(::SRT_INVALID_SOCK) {
-	onTSPacket = [this](TSPacket& obj) {
-		_tsReader.read(obj, *_publication);
+static const int StreamIdMaxSize = 512;
+static const Int64 TSReportMS = 10000;
+static const size_t RTTsMaxSize = 1024;
+
+SRTIn::SRTIn(const Parameters& configs, ServerAPI& api, SRTRuntime& runtime, SRTStats& stats): Thread("SRTIn"), _api(api), _runtime(runtime), _stats(stats), _started(false), _socket(::SRT_INVALID_SOCK), _backlog(32),
+	_tuning(configs), _gopCache(configs.getNumber<UInt32, 0x400000>("srt.gopCache")), _batchDelay(configs.getNumber<UInt32, 5>("srt.batchDelay")),
+	_pool(max<UInt32>(1, configs.getNumber<UInt32, 16>("srt.batchSize")) * TSChunkSize, configs.getNumber<UInt32, 256>("srt.poolSize")) {
+	onTSConnection = [this](TSConnection& connection) {
+		if (!_started)
+			return; // stopped meanwhile
+		string name;
+		if (SRTRuntime::BuildName(connection.streamId, name).empty())
+			name.assign(_name);
+		shared<Stream> pStream(new Stream(name, connection.pDemux));
+		Exception ex;
+		if (!(pStream->pPublication = _api.publish(ex, pStream->name))) {
+			ERROR("SRT publish ", pStream->name, ": ", ex)
+			::srt_close(connection.socket); // the SRTIn thread will release the caller on its next event
+			return;
+		}
+		_streams[connection.socket] = pStream;
+	};
+	onTSFrames = [this](TSFrames& obj) {
+		const auto& it = _streams.find(obj.socket);
+		if (it == _streams.end())
+			return;
+		LATENCY_RECORD(STAGE_HANDLER, obj.stamp);
+		Publication& publication = *it->second->pPublication;
+		if (obj.lost)
+			publication.reportLost(Media::TYPE_NONE, obj.lost);
+		for (TSFrame& frame : obj.frames) {
+			switch (frame.type) {
+				case Media::TYPE_AUDIO:
+					publication.writeAudio(frame.track, frame.audio, frame.packet);
+					break;
+				case Media::TYPE_VIDEO:
+					publication.writeVideo(frame.track, frame.video, frame.packet);
+					break;
+				default:
+					publication.writeData(frame.track, frame.data, frame.packet);
+			}
+		}
+		publication.flush();
 	};
-	onTSReset = [this]() {
-		_tsReader.flush(*_publication);
+	onTSReset = [this](TSReset& reset) {
+		const auto& it = _streams.find(reset.socket);
+		if (it == _streams.end())
+			return;
+		_api.unpublish(*it->second->pPublication);
+		_streams.erase(it);
 	};
 
+	// Relay targets (or failover lists) and listening address can override the transport options with a query (host:port?latency=300...)
+	vector<string> relays;
+	for (string& relay : SRTRuntime::Split(configs.getString("srt.relay", ""), relays)) {
+		_relays.emplace_back(string(), SRTSender::Options(configs));
+		_relays.back().first = move(_relays.back().second.parse(relay));
+	}
 	_host.assign(configs.getString("srt.host", "0.0.0.0:1234"));
+	_tuning.parse(_host);
 	_name.assign(configs.getString("srt.name", "srtIn"));
+	configs.getNumber("srt.backlog", _backlog);
 }
 
 SRTIn::~SRTIn() {
@@ -46,16 +98,35 @@ SRTIn::~SRTIn() {
 void SRTIn::stop() {
 	
 	Thread::stop();
+	_started = false;
 
-	if (_started) {
-		::srt_setloghandler(nullptr, nullptr);
-		::srt_cleanup();
-		_started = false;
+	for (auto& it : _streams)
+		_api.unpublish(*it.second->pPublication);
+	_streams.clear();
+
+	INFO("SRTIn buffer pool: ", _pool.hits(), " hits, ", _pool.misses(), " misses")
+}
+
+void SRTIn::onSubscribe(const Publication& publication) {
+	for (auto& it : _streams) {
+		if (it.second->pPublication != &publication || !it.second->pDemux)
+			continue;
+		if (!it.second->subscribers++)
+			INFO("SRT relay ", it.second->name, " subscribed, demux started")
+		*it.second->pDemux = true;
+		return;
 	}
+}
 
-	if (_publication) {
-		_api.unpublish(*_publication);
-		_publication = nullptr;
+void SRTIn::onUnsubscribe(const Publication& publication) {
+	for (auto& it : _streams) {
+		if (it.second->pPublication != &publication || !it.second->pDemux || !it.second->subscribers)
+			continue;
+		if (!--it.second->subscribers) {
+			*it.second->pDemux = false;
+			INFO("SRT relay ", it.second->name, " unsubscribed, demux stopped")
+		}
+		return;
 	}
 }
 
@@ -75,15 +146,8 @@ bool SRTIn::load() {
 		return false;
 	}
 
-	if (::srt_startup()) {
-		ERROR("SRTIn load: Error starting SRT library")
-		return false;
-	}
 	_started = true;
 
-	::srt_setloghandler(nullptr, LogCallback);
-	::srt_setloglevel(0xff);
-
 	Exception ex;
 	if (!_addr.set(ex, _host) || _addr.family() != IPAddress::IPv4) {
 		ERROR("SRTIn load: can't resolve target host, ", _host)
@@ -91,12 +155,6 @@ bool SRTIn::load() {
 		return false;
 	}
 
-	if (!(_publication = _api.publish(ex, _name))) {
-		ERROR("SRT publish: ", ex)
-		stop();
-		return false;
-	}
-
 	Thread::start();
 
 	return true;
@@ -111,12 +169,16 @@ bool SRTIn::run(Exception&, const volatile bool& requestStop) {
 		return false;
 	}
 
+	// Non-blocking listener, accepted sockets inherit this option
 	bool block = false;
 	if (::srt_setsockopt(_socket, 0, SRTO_RCVSYN, &block, sizeof(block)) != 0) {
 		disconnect();
-		ERROR("SRTIn SRTO_SNDSYN: ", ::srt_getlasterror_str());
+		ERROR("SRTIn SRTO_RCVSYN: ", ::srt_getlasterror_str());
 		return false;
 	}
+	_tuning.apply(_socket);
+	if (_tuning.autoTuning && ::srt_listen_callback(_socket, &SRTIn::OnListen, this) != 0)
+		WARN("SRTIn auto tuning: ", ::srt_getlasterror_str())
 
 	::SRT_SOCKSTATUS state = ::srt_getsockstate(_socket);
 	if (state != SRTS_INIT) {
@@ -137,7 +199,7 @@ bool SRTIn::run(Exception&, const volatile bool& requestStop) {
 		return false;
 	}
 
-	if (::srt_listen(_socket, 1)) {
+	if (::srt_listen(_socket, _backlog)) {
 		ERROR("SRTIn Listen: ", ::srt_getlasterror_str());
 		disconnect();
 		return false;
@@ -150,136 +212,292 @@ bool SRTIn::run(Exception&, const volatile bool& requestStop) {
 		return false;
 	}
 
-	int modes = SRT_EPOLL_IN;
+	int modes = SRT_EPOLL_IN | SRT_EPOLL_ERR;
 	::srt_epoll_add_usock(epollid, _socket, &modes);
 
-	// Accept 1 connection at a time
+	// One epoll set for the listener and all the callers
 	while (!requestStop) {
 
-		// Wait for a connection
-		const int socksToPoll = 10;
-		int rfdn = socksToPoll;
-		::SRTSOCKET rfds[socksToPoll];
-		int rc = 0;
-		::SRTSOCKET newSocket;
-		for (;;) {
-
-			if ((rc = ::srt_epoll_wait(epollid, &rfds[0], &rfdn, nullptr, nullptr, EpollWaitTimoutMS, nullptr, nullptr, nullptr, nullptr)) > 0) {
-
-				sockaddr_in scl;
-				int sclen = sizeof scl;
-				newSocket = ::srt_accept(_socket, (sockaddr*)&scl, &sclen);
-				if (newSocket == SRT_INVALID_SOCK) {
-					ERROR("SRTIn epoll wait: ", ::srt_getlasterror_str());
-					disconnect();
-					return false;
-				}
-				INFO("Connection from ", SocketAddress(*((sockaddr*)(&scl))))
-				break;
-			}
+		// Wake up at the earliest batch deadline
+		Int64 now = Time::Now();
+		Int64 timeout = EpollWaitTimoutMS;
+		for (auto& it : _callers) {
+			if (it.second.pBatch && it.second.pBatch->size())
+				timeout = min(timeout, max<Int64>(0, it.second.time + _batchDelay - now));
+		}
 
+		_readySockets.resize(_callers.size() + 1);
+		int rfdn = (int)_readySockets.size();
+		if (::srt_epoll_wait(epollid, _readySockets.data(), &rfdn, nullptr, nullptr, timeout, nullptr, nullptr, nullptr, nullptr) <= 0) {
 			// ETIMEOUT is not an error
 			if (::srt_getlasterror(NULL) != SRT_ETIMEOUT) {
 				ERROR("SRTIn epoll wait: ", ::srt_getlasterror_str());
-				disconnect();
-				return false;
+				break;
 			}
+			rfdn = 0;
+		}
 
-			if (requestStop) {
-				disconnect();
-				return true;
+		for (int i = 0; i < rfdn; ++i) {
+			::SRTSOCKET socket = _readySockets[i];
+			if (socket == _socket) {
+				accept(epollid);
+				continue;
 			}
+			const auto& it = _callers.find(socket);
+			if (it != _callers.end() && !receive(socket, it->second))
+				close(epollid, socket);
 		}
 
-		// Create the new socket for the SRT publisher
-		bool blocking = true;
-		if (::srt_setsockopt(newSocket, 0, SRTO_RCVSYN, &blocking, sizeof blocking) == -1) {
-			ERROR("SRTIn SRTO_RCVSYN: ", ::srt_getlasterror_str());
-			disconnect();
-			return false;
+		// Flush the batches which have reached their deadline
+		now = Time::Now();
+		for (auto& it : _callers) {
+			if (it.second.pBatch && it.second.pBatch->size() && (now - it.second.time) >= _batchDelay)
+				flush(it.first, it.second);
+			it.second.inspector.check();
+			it.second.pStats->sample(it.first, now, 0, &it.second.inspector.health());
+			report(it.second, now);
 		}
+	}
 
-		int epollid2 = ::srt_epoll_create();
-		if (epollid < 0) {
-			ERROR("Error initializing UDT epoll set;", ::srt_getlasterror_str());
-			disconnect();
-			return false;
-		}
+	INFO("End of SRTIn process")
 
-		modes = SRT_EPOLL_IN;
-		::srt_epoll_add_usock(epollid2, newSocket, &modes);
-
-		// Accept Input until an error is received
-		while (!requestStop && epollid2 >= 0) {
-			shared<Buffer> pBuffer(new Buffer(TSChunkSize));
-			bool ready = true;
-			int stat;
-			do {
-				stat = ::srt_recvmsg(newSocket, STR pBuffer->data(), TSChunkSize);
-				if (stat == SRT_ERROR) {
-
-					// EAGAIN for SRT READING
-					int error = ::srt_getlasterror(NULL);
-					if (error == SRT_EASYNCRCV) {
-
-						// Poll on this descriptor until reading is available, indefinitely.
-						int len = 2;
-						::SRTSOCKET ready[2];
-						if ((stat = ::srt_epoll_wait(epollid2, ready, &len, 0, 0, EpollWaitTimoutMS, 0, 0, 0, 0)) != -1) {
-							stat = 0;
-							continue;
-						}
-						// If was -1, then passthru.
-					}
-					else if (error != ::SRT_ECONNLOST) // not an error
-						ERROR("SRTIn recvmsg : ", ::srt_getlasterror_str())
-					break;
-				}
+	while (!_callers.empty())
+		close(epollid, _callers.begin()->first);
 
-				if (stat == 0) {
-					// Not necessarily eof. Closed connection is reported as error.
-					this_thread::sleep_for(chrono::milliseconds(10));
-					ready = false;
-				}
-			} while (!ready && stat >= 0);
+	::srt_epoll_remove_usock(epollid, _socket);
+	disconnect();
 
-			// Error received, we stop reading
-			if (stat < 0)
-				break;
+	// Release epoll id
+	if (epollid > 0)
+		::srt_epoll_release(epollid);
 
-			// Data found => we push it to the publication
-			if (ready && stat > 0) {
-				if ((UInt32)stat < pBuffer->size())
-					pBuffer->resize(stat);
+	return true;
+}
 
-				// Push TS data to the publication (switch thread to main thread)
-				_api.handler.queue(onTSPacket, Packet(pBuffer));
+void SRTIn::accept(int epollid) {
+
+	for (;;) {
+		sockaddr_in scl;
+		int sclen = sizeof scl;
+		::SRTSOCKET socket = ::srt_accept(_socket, (sockaddr*)&scl, &sclen);
+		if (socket == SRT_INVALID_SOCK) {
+			// EAGAIN, no more pending connection
+			if (::srt_getlasterror(NULL) != SRT_EASYNCRCV)
+				ERROR("SRTIn accept: ", ::srt_getlasterror_str());
+			return;
+		}
+
+		char streamId[StreamIdMaxSize];
+		int size = sizeof(streamId);
+		if (::srt_getsockflag(socket, SRTO_STREAMID, streamId, &size) != 0)
+			size = 0;
+
+		bool block = false;
+		int modes = SRT_EPOLL_IN | SRT_EPOLL_ERR;
+		if (::srt_setsockopt(socket, 0, SRTO_RCVSYN, &block, sizeof(block)) != 0 || ::srt_epoll_add_usock(epollid, socket, &modes) != 0) {
+			ERROR("SRTIn add caller: ", ::srt_getlasterror_str());
+			::srt_close(socket);
+			continue;
+		}
+		string name;
+		if (SRTRuntime::BuildName(string(streamId, size), name).empty())
+			name.assign(_name);
+		Caller& caller = _callers[socket];
+		caller.pStats = _stats.add(name, "caller");
+		caller.streamId.assign(streamId, size);
+		int latency = 0;
+		int latencySize = sizeof(latency);
+		if (::srt_getsockflag(socket, SRTO_RCVLATENCY, &latency, &latencySize) == 0)
+			caller.latency = Int64(latency) * 1000;
+
+		INFO("Connection from ", SocketAddress(*((sockaddr*)(&scl))), " with streamid '", string(streamId, size), "'")
+
+		// Relay outputs with the streamid of the caller, the publication is demuxed only once subscribed
+		if (!_relays.empty()) {
+			caller.pDemux.reset(new atomic<bool>(false));
+			caller.demuxing = false;
+			for (const auto& relay : _relays) {
+				caller.outputs.emplace_back(new SRTOutput(relay.second, relay.first, "", _stats.add(relay.first, "relay"), caller.streamId));
+				_runtime.add(caller.outputs.back());
 			}
-		} // while (!requestStop && epollid2 >= 0)
+		}
 
-		// Reset the TS reader (switch thread to main thread)
-		_api.handler.queue(onTSReset);
+		// Create the publication (switch thread to main thread)
+		_api.handler.queue(onTSConnection, socket, string(streamId, size), caller.pDemux);
+	}
+}
 
-		// Destroy the publisher socket
-		::srt_epoll_remove_usock(epollid2, newSocket);
+bool SRTIn::receive(::SRTSOCKET socket, Caller& caller) {
+
+	// Read until EAGAIN, the socket is level-triggered in the epoll set
+	for (;;) {
+		if (!caller.pBatch)
+			caller.pBatch = _pool.acquire();
+		Buffer& batch = *caller.pBatch;
+		UInt32 size = batch.size();
+		batch.resize(size + TSChunkSize); // in capacity, no reallocation
+
+		::SRT_MSGCTRL control = ::srt_msgctrl_default;
+		int stat = ::srt_recvmsg2(socket, STR batch.data() + size, TSChunkSize, &control);
+		batch.resize(size + max(stat, 0));
+		if (stat > 0) {
+			UInt8 flags = caller.inspector.inspect(batch.data() + size, stat);
+			Int64 time = SourceTime(caller, control);
+			if (!caller.outputs.empty())
+				caller.messages.emplace_back(stat, flags, time);
+		}
+		if (stat == SRT_ERROR) {
+			int error = ::srt_getlasterror(NULL);
+			if (error == SRT_EASYNCRCV)
+				return true; // EAGAIN for SRT READING
+			if (error != ::SRT_ECONNLOST) // not an error
+				ERROR("SRTIn recvmsg : ", ::srt_getlasterror_str())
+			return false;
+		}
+		if (!stat)
+			return true; // Not necessarily eof. Closed connection is reported as error.
 
-		// Release epoll id
-		if (epollid2 > 0)
-			::srt_epoll_release(epollid2);
+		if (!size) {
+			caller.time = Time::Now();
+			LATENCY_STAMP(caller.stamp);
+		}
+		if (batch.size() + TSChunkSize > _pool.bufferSize)
+			flush(socket, caller); // batch full
+	}
+}
 
-	} // while (!requestStop)
+Int64 SRTIn::SourceTime(Caller& caller, const ::SRT_MSGCTRL& control) {
+	if (control.srctime <= 0)
+		return 0;
+	// srctime is the delivery time planned by TSBPD: source time + latency, on the local libsrt clock
+	// Only the delay to read the message after this time is measured, the sending time is not known here
+	Int64 time = control.srctime - caller.latency;
+	Int64 delivery = ::srt_time_now() - control.srctime;
+	if (delivery < 0)
+		return time;
+	SRTStats::Series& stats = *caller.pStats;
+	stats.delivery.record(delivery);
+	// RFC 3550 jitter
+	if (caller.delivery)
+		stats.deliveryJitter += ((delivery > caller.delivery ? delivery - caller.delivery : caller.delivery - delivery) - stats.deliveryJitter) / 16;
+	caller.delivery = delivery;
+	return time;
+}
 
-	INFO("End of SRTIn process")
+void SRTIn::flush(::SRTSOCKET socket, Caller& caller, bool end) {
 
-	// Release epoll id
-	if (epollid > 0)
-		::srt_epoll_release(epollid);
+	// Demux only while subscribed in relay mode, the reader restarts on the next PES
+	bool demux = !caller.pDemux || caller.pDemux->load();
+	if (!demux && caller.demuxing) {
+		caller.tsReader.flush(caller.demuxer);
+		caller.demuxer.frames.clear();
+	}
+	caller.demuxing = demux;
+
+	if (caller.pBatch && caller.pBatch->size()) {
+		Packet batch(caller.pBatch);
+		LATENCY_RECORD(STAGE_BATCH, caller.stamp);
+		if (!caller.outputs.empty())
+			relay(caller, batch);
+		if (demux) {
+			LATENCY_STAMP(caller.stamp);
+			caller.tsReader.read(batch, caller.demuxer);
+			LATENCY_RECORD(STAGE_DEMUX, caller.stamp);
+		}
+	}
+	caller.pBatch.reset(); // the reader has copied what it needs, the buffer returns to the pool once relayed
+	if (end && demux)
+		caller.tsReader.flush(caller.demuxer);
+	if (caller.demuxer.frames.empty() && !caller.demuxer.lost)
+		return;
+	// Push the frames to the publication (switch thread to main thread)
+	_api.handler.queue(onTSFrames, socket, caller.demuxer.frames, caller.demuxer.lost);
+	caller.demuxer.lost = 0;
+}
 
-	return true;
+void SRTIn::report(Caller& caller, Int64 now) {
+	const TSInspector::Health& health = caller.inspector.health();
+	if (health.errors() == caller.errors || (now - caller.reportTime) < TSReportMS)
+		return;
+	caller.errors = health.errors();
+	caller.reportTime = now;
+	WARN("SRT caller ", caller.pStats->name, " TS errors; sync loss ", health.syncLoss, ", sync ", health.syncErrors, ", PAT ", health.patErrors,
+		", continuity ", health.continuityErrors, ", PMT ", health.pmtErrors, ", PID ", health.pidErrors, ", transport ", health.transportErrors,
+		", CRC ", health.crcErrors, ", PCR repetition ", health.pcrRepetitionErrors, ", PCR discontinuity ", health.pcrDiscontinuityErrors, ", PCR jitter ", health.pcrJitter, "us")
+}
+
+void SRTIn::relay(Caller& caller, const Packet& batch) {
+	const UInt8* data = batch.data();
+	for (const Caller::Message& message : caller.messages) {
+		TSPacker::Payload payload(Packet(batch, data, message.size), message.flags, message.time); // keeps the source time for the next hop
+		data += message.size;
+		// A new GOP starts on a video random access point, (re)connected outputs start with it
+		if (payload.flags & TSPacker::FLAG_KEY) {
+			caller.gop.clear();
+			caller.gopSize = _gopCache ? 0 : -1;
+		}
+		for (const shared<SRTOutput>& pOutput : caller.outputs) {
+			pOutput->join(caller.gop);
+			pOutput->write(payload);
+		}
+		if (caller.gopSize == UInt32(-1))
+			continue;
+		if ((caller.gopSize += message.size) > _gopCache) {
+			caller.gop.clear();
+			caller.gopSize = -1;
+		} else
+			caller.gop.emplace_back(payload); // shares the batch buffer
+	}
+	caller.messages.clear();
 }
 
+int SRTIn::OnListen(void* opaque, ::SRTSOCKET socket, int hsVersion, const sockaddr* pAddress, const char* streamId) {
+	SRTIn& in = *(SRTIn*)opaque;
+	double rtt;
+	{
+		lock_guard<mutex> lock(in._mutex);
+		const auto& it = in._rtts.find(streamId ? streamId : "");
+		if (it == in._rtts.end())
+			return 0; // first connection, listener options
+		rtt = it->second;
+	}
+	int latency = in._tuning.latencyFor(rtt);
+	if (::srt_setsockflag(socket, SRTO_LATENCY, &latency, sizeof(latency)) != 0)
+		WARN("SRTIn SRTO_LATENCY: ", ::srt_getlasterror_str())
+	else
+		DEBUG("SRTIn caller '", streamId ? streamId : "", "' latency ", latency, "ms for a RTT of ", rtt, "ms")
+	return 0;
+}
+
+void SRTIn::close(int epollid, ::SRTSOCKET socket) {
+
+	::srt_epoll_remove_usock(epollid, socket);
+	const auto& it = _callers.find(socket);
+	// Auto tuning, remember the RTT for the latency of the next connection
+	::SRT_TRACEBSTATS stats;
+	if (it != _callers.end() && _tuning.autoTuning && ::srt_bstats(socket, &stats, 0) == 0 && stats.msRTT > 0) {
+		lock_guard<mutex> lock(_mutex);
+		if (_rtts.size() >= RTTsMaxSize && !_rtts.count(it->second.streamId))
+			_rtts.clear(); // bounded with any streamid, only the recent callers matter
+		_rtts[it->second.streamId] = stats.msRTT;
+	}
+	::srt_close(socket);
+	if (it != _callers.end()) {
+		flush(socket, it->second, true);
+		_stats.remove(it->second.pStats);
+		for (const shared<SRTOutput>& pOutput : it->second.outputs) {
+			_runtime.remove(pOutput);
+			_stats.remove(pOutput->pStats);
+		}
+		const TSInspector::Health& health = it->second.inspector.health();
+		INFO("SRT caller ", socket, " TS: ", health.packets, " packets, ", health.errors(), " errors")
+		const Histogram& delivery = it->second.pStats->delivery;
+		if (delivery.count())
+			INFO("SRT caller ", socket, " delivery delay p50 ", delivery.percentile(0.5) / 1000, "ms, p99 ", delivery.percentile(0.99) / 1000, "ms, max ", delivery.max() / 1000, "ms, jitter ", UInt32(it->second.pStats->deliveryJitter / 1000), "ms")
+		_callers.erase(it);
+	}
+	INFO("SRT caller ", socket, " disconnected, buffer pool: ", _pool.hits(), " hits, ", _pool.misses(), " misses")
 
-void SRTIn::LogCallback(void* opaque, int level, const char* file, int line, const char* area, const char* message) {
-	if (level != 7)
-		INFO("L:", level, "|", file, "|", line, "|", area, "|", message)
+	// Reset the TS reader and unpublish (switch thread to main thread)
+	_api.handler.queue(onTSReset, socket);
 }
@@ -0,0 +1,199 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "SRTLog.h"
+#include "SRTRuntime.h"
+#include "Mona/Logs.h"
+#include "Mona/Time.h"
+
+using namespace Mona;
+using namespace std;
+
+static const UInt32 DrainMS = 50;
+static const Int64 ReportMS = 10000;
+
+atomic<UInt64> SRTLog::_Overflows(0);
+atomic<UInt64> SRTLog::_RateDrops(0);
+atomic<UInt64> SRTLog::_Duplicates(0);
+
+// libsrt functional areas, srt.logAreas names
+static const struct { const char* name; int id; } Areas[] = {
+	{ "general", SRT_LOGFA_GENERAL }, { "bstats", SRT_LOGFA_BSTATS }, { "control", SRT_LOGFA_CONTROL }, { "data", SRT_LOGFA_DATA },
+	{ "tsbpd", SRT_LOGFA_TSBPD }, { "rexmit", SRT_LOGFA_REXMIT }, { "haicrypt", SRT_LOGFA_HAICRYPT }, { "congest", SRT_LOGFA_CONGEST }
+};
+
+static UInt32 Capacity(UInt32 capacity) {
+	UInt32 power(16);
+	while (power < capacity)
+		power <<= 1;
+	return power;
+}
+
+SRTLog::SRTLog(const Parameters& configs) : Thread("SRTLog"), _level(configs.getNumber<int, 5>("srt.logLevel")), _rate(configs.getNumber<UInt32, 50>("srt.logRate")), _started(false),
+	_entries(Capacity(configs.getNumber<UInt32, 1024>("srt.logQueue"))), _mask(_entries.size() - 1), _head(0), _tail(0),
+	_tokens(0), _tokensTime(0), _lastLevel(0), _repeats(0), _reportTime(0), _reported(0) {
+	for (UInt32 i = 0; i < _entries.size(); ++i)
+		_entries[i].sequence = i;
+	vector<string> areas;
+	for (const string& area : SRTRuntime::Split(configs.getString("srt.logAreas", ""), areas)) {
+		bool found = false;
+		for (auto& it : Areas) {
+			if ((found = String::ICompare(area.c_str(), it.name) == 0)) {
+				_areas.emplace_back(it.id);
+				break;
+			}
+		}
+		if (!found)
+			WARN("Unknown libsrt log area ", area, " in srt.logAreas")
+	}
+}
+
+bool SRTLog::start() {
+	if (_started)
+		return true;
+	_started = true;
+	_tokens = _rate;
+	_tokensTime = _reportTime = Time::Now();
+	Thread::start();
+	::srt_setloglevel(_level);
+	if (!_areas.empty())
+		::srt_resetlogfa(_areas.data(), _areas.size());
+	// Time, thread and level are given by the server logs
+	::srt_setlogflags(SRT_LOGF_DISABLE_TIME | SRT_LOGF_DISABLE_THREADNAME | SRT_LOGF_DISABLE_SEVERITY | SRT_LOGF_DISABLE_EOL);
+	::srt_setloghandler(this, Callback);
+	return true;
+}
+
+void SRTLog::stop() {
+	if (!_started)
+		return;
+	::srt_setloghandler(nullptr, nullptr);
+	_wakeUp.set();
+	Thread::stop();
+	_started = false;
+}
+
+void SRTLog::Callback(void* opaque, int level, const char* file, int line, const char* area, const char* message) {
+	((SRTLog*)opaque)->push(level, area, message);
+}
+
+void SRTLog::push(int level, const char* area, const char* message) {
+	if (level > _level)
+		return;
+
+	// Bounded MPSC ring (Vyukov), a message is lost rather than blocking a SRT thread
+	UInt32 head = _head.load(memory_order_relaxed);
+	Entry* pEntry;
+	for (;;) {
+		pEntry = &_entries[head & _mask];
+		Int32 diff = Int32(pEntry->sequence.load(memory_order_acquire) - head);
+		if (!diff) {
+			if (_head.compare_exchange_weak(head, head + 1, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			++_Overflows;
+			return;
+		} else
+			head = _head.load(memory_order_relaxed);
+	}
+	pEntry->level = UInt8(level);
+	strncpy(pEntry->area, area ? area : "", sizeof(pEntry->area) - 1);
+	pEntry->area[sizeof(pEntry->area) - 1] = 0;
+	size_t size = message ? strlen(message) : 0;
+	pEntry->size = UInt16(min(size, sizeof(pEntry->message)));
+	memcpy(pEntry->message, message, pEntry->size);
+	pEntry->sequence.store(head + 1, memory_order_release);
+}
+
+bool SRTLog::pop(Entry& entry) {
+	UInt32 tail = _tail.load(memory_order_relaxed);
+	Entry& slot = _entries[tail & _mask];
+	if (Int32(slot.sequence.load(memory_order_acquire) - (tail + 1)) < 0)
+		return false; // empty
+	entry.level = slot.level;
+	memcpy(entry.area, slot.area, sizeof(entry.area));
+	entry.size = slot.size;
+	memcpy(entry.message, slot.message, slot.size);
+	slot.sequence.store(tail + _mask + 1, memory_order_release);
+	_tail.store(tail + 1, memory_order_relaxed);
+	return true;
+}
+
+bool SRTLog::run(Exception&, const volatile bool& requestStop) {
+	Entry entry;
+	for (;;) {
+		bool stopping = requestStop; // drain the ring once more after the stop request
+		while (pop(entry))
+			write(entry);
+
+		Int64 now = Time::Now();
+		if ((now - _reportTime) >= ReportMS || stopping) {
+			repeated();
+			UInt64 dropped = _Overflows + _RateDrops;
+			if (dropped != _reported) {
+				WARN("SRT log: ", _Overflows, " messages lost (queue full), ", _RateDrops, " over the rate limit, ", _Duplicates, " repetitions filtered")
+				_reported = dropped;
+			}
+			_reportTime = now;
+		}
+		if (stopping)
+			return true;
+		_wakeUp.wait(DrainMS);
+	}
+}
+
+void SRTLog::write(const Entry& entry) {
+	string area(entry.area), message(entry.message, entry.size);
+	if (entry.level == _lastLevel && area == _lastArea && message == _lastMessage) {
+		++_repeats;
+		++_Duplicates;
+		return;
+	}
+	repeated();
+	_lastLevel = entry.level;
+	_lastArea = move(area);
+	_lastMessage = move(message);
+
+	// Token bucket refilled at srt.logRate messages by second, with one second of burst
+	if (_rate) {
+		Int64 now = Time::Now();
+		_tokens = min<double>(_rate, _tokens + (now - _tokensTime) * _rate / 1000.0);
+		_tokensTime = now;
+		if (_tokens < 1) {
+			++_RateDrops;
+			return;
+		}
+		--_tokens;
+	}
+	write(_lastLevel, _lastArea, _lastMessage);
+}
+
+void SRTLog::repeated() {
+	if (!_repeats)
+		return;
+	write(_lastLevel, _lastArea, String("last message repeated ", _repeats, " times"));
+	_repeats = 0;
+}
+
+void SRTLog::write(UInt8 level, const string& area, const string& message) {
+	if (level <= 3) // LOG_CRIT, LOG_ERR
+		ERROR("SRT ", area, ": ", message)
+	else if (level == 4) // LOG_WARNING
+		WARN("SRT ", area, ": ", message)
+	else if (level <= 6) // LOG_NOTICE, LOG_INFO
+		INFO("SRT ", area, ": ", message)
+	else
+		DEBUG("SRT ", area, ": ", message)
+}
@@ -0,0 +1,300 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "SRTOutput.h"
+#include "Mona/Logs.h"
+#include "Mona/String.h"
+#include "Mona/Time.h"
+
+using namespace Mona;
+using namespace std;
+
+static const Int64 reconnectPeriodMS = 1000;
+static const Int64 scorePeriodMS = 1000;
+static const Int64 switchTimeoutMS = 5000; // switch without keyframe (audio only...)
+
+SRTOutput::SRTOutput(const Options& options, const string& host, const string& standby, const shared<SRTStats::Series>& pStats, const string& streamId) : SRTSender(options, pStats), host(host), streamId(streamId), _failovers(0),
+	_scoreTime(0), _switchTime(0) {
+	vector<string> hosts;
+	String::Split(host, "|", hosts, String::SPLIT_IGNORE_EMPTY | String::SPLIT_TRIM);
+	if (!standby.empty())
+		hosts.emplace_back(standby);
+	_links.reserve(hosts.size());
+	for (const string& host : hosts)
+		_links.emplace_back(host);
+}
+
+SRTOutput::Link* SRTOutput::link(::SRTSOCKET socket) {
+	for (Link& link : _links) {
+		if (link.socket == socket)
+			return &link;
+	}
+	return NULL;
+}
+
+void SRTOutput::onManage(SRTRuntime::Reactor& reactor, Int64 now) {
+
+	for (Link& link : _links) {
+		::SRT_SOCKSTATUS state = link.socket == ::SRT_INVALID_SOCK ? ::SRTS_NONEXIST : ::srt_getsockstate(link.socket);
+		switch (state) {
+			case ::SRTS_CONNECTED:
+				if (!link.connected)
+					onWritable(reactor, link.socket);
+				continue;
+			case ::SRTS_BROKEN:
+			case ::SRTS_NONEXIST:
+			case ::SRTS_CLOSED:
+				break;
+			default:
+				continue; // connecting
+		}
+
+		// Switch immediately to the standby, then wait a bit before to try again
+		disconnect(reactor, link);
+		if (now - link.connectTime < reconnectPeriodMS)
+			continue;
+
+		// Resolution in background, never blocks the reactor
+		SocketAddress address;
+		if (!reactor.runtime.resolve(link.host, address))
+			continue;
+		link.connectTime = now;
+
+		INFO("Reconnect socket to ", link.host, ", write latency p99 ", writeLatency().percentile(0.99), "us")
+		if (!connect(reactor, link, address))
+			ERROR("Error issuing connect");
+	}
+
+	::SRTSOCKET socket = _connectedSocket;
+	if (socket == ::SRT_INVALID_SOCK)
+		return;
+	if (!link(socket)) {
+		// closed while a keyframe switch was taking it
+		Link* pLink = candidate(NULL);
+		INFO("SRT switch to ", pLink ? pLink->host : "no link", " cancelled")
+		if (pLink)
+			activate(pLink->socket);
+		else
+			_connectedSocket = ::SRT_INVALID_SOCK;
+		return;
+	}
+	if (now - _scoreTime >= scorePeriodMS) {
+		_scoreTime = now;
+		for (Link& link : _links) {
+			if (link.connected)
+				score(link);
+		}
+		select(now);
+	}
+	control(now);
+	flush();
+}
+
+void SRTOutput::score(Link& link) {
+	::SRT_TRACEBSTATS stats;
+	if (::srt_bstats(link.socket, &stats, 0) < 0)
+		return; // never cleared, the interval counters are shared with the stats and the congestion control
+	int latency = 0;
+	int size = sizeof(latency);
+	if (::srt_getsockflag(link.socket, SRTO_PEERLATENCY, &latency, &size) < 0 || latency <= 0)
+		latency = 120; // SRT default
+
+	// Worst of the degradations, a standby link without traffic is scored on its RTT
+	// Loss rate since the previous score, from the totals of the link
+	Int64 sent = stats.pktSentTotal - link.sent;
+	Int64 lost = stats.pktSndLossTotal - link.lost;
+	link.sent = stats.pktSentTotal;
+	link.lost = stats.pktSndLossTotal;
+	double degradation = stats.msRTT / _options.maxRTT;
+	if (sent > 0)
+		degradation = max(degradation, 100.0 * lost / sent / _options.maxLoss);
+	degradation = max(degradation, double(stats.msSndBuf) / latency);
+	double score = 100 * (1 - min(1.0, degradation));
+	link.score = link.score < 0 ? score : (link.score * 7 + score * 3) / 10;
+}
+
+SRTOutput::Link* SRTOutput::candidate(const Link* pExcept) {
+	Link* pBest = NULL;
+	for (Link& link : _links) {
+		if (&link == pExcept || !link.connected)
+			continue;
+		if (link.score >= _options.failoverScore + _options.failoverHysteresis)
+			return &link;
+		if (!pBest || link.score > pBest->score)
+			pBest = &link;
+	}
+	return pBest;
+}
+
+void SRTOutput::select(Int64 now) {
+	Link* pActive = link(_connectedSocket);
+	if (!pActive)
+		return;
+	::SRTSOCKET switching = this->switching();
+	if (switching != ::SRT_INVALID_SOCK) {
+		// Waiting a keyframe, beyond the timeout the new link starts with the cached GOP
+		if (now - _switchTime >= switchTimeoutMS) {
+			switchTo(::SRT_INVALID_SOCK);
+			Link* pLink = link(switching);
+			if (pLink && pLink->connected) {
+				WARN("SRT switch to ", pLink->host, " without keyframe")
+				activate(switching);
+			}
+		}
+		return;
+	}
+	if (_switchTime && now - _switchTime < _options.failoverHold)
+		return;
+
+	// First healthy link of the list, the active one is kept while not degraded
+	double healthy = _options.failoverScore + _options.failoverHysteresis;
+	for (Link& link : _links) {
+		if (&link == pActive) {
+			if (link.score < 0 || link.score >= _options.failoverScore)
+				return;
+			continue;
+		}
+		if (!link.connected || link.score < healthy)
+			continue;
+		if (pActive->score < _options.failoverScore) {
+			++_failovers;
+			WARN("SRT link to ", pActive->host, " degraded (score ", UInt32(pActive->score), "), failover to ", link.host, " (score ", UInt32(link.score), ") on next keyframe")
+		} else
+			INFO("SRT link to ", link.host, " healthy again (score ", UInt32(link.score), "), switch from ", pActive->host, " on next keyframe")
+		_switchTime = now;
+		switchTo(link.socket);
+		return;
+	}
+}
+
+void SRTOutput::onReadable(SRTRuntime::Reactor& reactor, ::SRTSOCKET socket) {
+	Link* pLink = link(socket);
+	if (!pLink)
+		return;
+	if (::srt_getsockstate(socket) != ::SRTS_CONNECTED) {
+		// broken, failover right now (reconnection on next manage)
+		if (pLink->connected)
+			disconnect(reactor, *pLink);
+		return;
+	}
+	// Discard incoming data
+	char buf[1500];
+	while (::srt_recvmsg(socket, &buf[0], sizeof(buf)) > 0)
+		continue;
+}
+
+void SRTOutput::onWritable(SRTRuntime::Reactor& reactor, ::SRTSOCKET socket) {
+	Link* pLink = link(socket);
+	if (!pLink || pLink->connected || ::srt_getsockstate(socket) != ::SRTS_CONNECTED)
+		return;
+	// Connected, just wait incoming data now
+	reactor.watch(socket, *this, SRT_EPOLL_IN | SRT_EPOLL_ERR);
+	pLink->connected = true;
+	if (_connectedSocket == ::SRT_INVALID_SOCK) {
+		INFO("SRT connected to ", pLink->host)
+		activate(socket);
+	} else
+		INFO("SRT standby connected to ", pLink->host)
+}
+
+void SRTOutput::onClose(SRTRuntime::Reactor& reactor) {
+	for (Link& link : _links)
+		disconnect(reactor, link);
+}
+
+bool SRTOutput::connect(SRTRuntime::Reactor& reactor, Link& link, const SocketAddress& address) {
+
+	::SRTSOCKET socket = ::srt_socket(AF_INET, SOCK_DGRAM, 0);
+	if (socket == ::SRT_INVALID_SOCK) {
+		ERROR("SRT create socket: ", ::srt_getlasterror_str());
+		return false;
+	}
+
+	bool block = false;
+	int rc = ::srt_setsockopt(socket, 0, SRTO_SNDSYN, &block, sizeof(block));
+	if (rc != 0) {
+		ERROR("SRT SRTO_SNDSYN: ", ::srt_getlasterror_str());
+		::srt_close(socket);
+		return false;
+	}
+	rc = ::srt_setsockopt(socket, 0, SRTO_RCVSYN, &block, sizeof(block));
+	if (rc != 0) {
+		ERROR("SRT SRTO_RCVSYN: ", ::srt_getlasterror_str());
+		::srt_close(socket);
+		return false;
+	}
+
+	int opt = 1;
+	::srt_setsockflag(socket, ::SRTO_SENDER, &opt, sizeof opt);
+	if (!streamId.empty() && ::srt_setsockflag(socket, SRTO_STREAMID, streamId.data(), streamId.size()) != 0) {
+		ERROR("SRT SRTO_STREAMID: ", ::srt_getlasterror_str());
+		::srt_close(socket);
+		return false;
+	}
+	// Transport options, on reconnection auto tuning uses the RTT and the bitrate measured so far
+	_options.tuning.apply(socket, rtt(), bitrate());
+
+	::SRT_SOCKSTATUS state = ::srt_getsockstate(socket);
+	if (state != SRTS_INIT) {
+		ERROR("SRT Connect: socket is in bad state; ", state)
+		::srt_close(socket);
+		return false;
+	}
+
+	INFO("Connecting to ", address.host(), " port ", address.port())
+
+	// SRT support only IPV4 so we convert to a sockaddr_in
+	sockaddr soaddr;
+	memcpy(&soaddr, address.data(), sizeof(sockaddr)); // WARN: work only with ipv4 addresses
+	soaddr.sa_family = AF_INET;
+	// Non-blocking connect, writable once connected
+	if (::srt_connect(socket, &soaddr, sizeof(sockaddr)) < 0 || !reactor.watch(socket, *this, SRT_EPOLL_IN | SRT_EPOLL_OUT | SRT_EPOLL_ERR)) {
+		ERROR("SRT Connect: ", ::srt_getlasterror_str());
+		::srt_close(socket);
+		return false;
+	}
+
+	INFO("SRT connect state; ", ::srt_getsockstate(socket));
+	link.socket = socket;
+	return true;
+}
+
+void SRTOutput::disconnect(SRTRuntime::Reactor& reactor, Link& link) {
+	if (link.socket == ::SRT_INVALID_SOCK)
+		return;
+
+	if (_connectedSocket == link.socket) {
+		// Writers drop their payloads from now
+		_connectedSocket.store(::SRT_INVALID_SOCK, memory_order_release);
+		INFO("SRT payloads dropped to ", host, ": ", drops().full, " queue full, ", drops().disposable, " non-reference, ", drops().gop, " GOP, ", drops().ttl, " too late, ", drops().errors, " refused, pacing delay p99 ", pacingDelay().percentile(0.99), "us")
+		flush(); // drop the queue if not sending
+		// Switch to the best connected link, it starts with the cached GOP
+		if (Link* pOther = candidate(&link)) {
+			++_failovers;
+			_switchTime = Time::Now();
+			WARN("SRT link to ", link.host, " broken, failover to ", pOther->host)
+			activate(pOther->socket);
+		}
+	} else if (switching() == link.socket)
+		switchTo(::SRT_INVALID_SOCK);
+
+	reactor.unwatch(link.socket);
+	::srt_close(link.socket);
+	INFO("SRT disconnect state; ", ::srt_getsockstate(link.socket));
+	link.socket = ::SRT_INVALID_SOCK;
+	link.connected = false;
+	link.score = -1;
+	link.sent = link.lost = 0;
+}
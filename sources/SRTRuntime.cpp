@@ -0,0 +1,386 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "SRTRuntime.h"
+#include "Mona/Logs.h"
+#include "Mona/Time.h"
+#include "Mona/String.h"
+
+using namespace Mona;
+using namespace std;
+
+static const Int64 resolveRetryMS = 1000;
+
+SRTRuntime::SRTRuntime(const Parameters& configs) : _started(false),
+	_reactorsCount(max<UInt16>(1, configs.getNumber<UInt16, 2>("srt.reactors"))),
+	_resolver(configs.getNumber<UInt32, 60000>("srt.dnsTTL")), _log(configs) {
+}
+
+SRTRuntime::~SRTRuntime() {
+	stop();
+}
+
+bool SRTRuntime::start() {
+	if (_started)
+		return true;
+
+	if (::srt_startup() < 0) {
+		ERROR("SRT runtime: Error starting SRT library")
+		return false;
+	}
+	_started = true;
+
+	_log.start();
+
+	_resolver.start();
+	for (UInt16 i = 0; i < _reactorsCount; ++i) {
+		_reactors.emplace_back(new Reactor(*this, i));
+		_reactors.back()->start();
+	}
+	INFO("SRT runtime started with ", _reactorsCount, " reactors")
+	return true;
+}
+
+void SRTRuntime::stop() {
+	if (!_started)
+		return;
+
+	// Reactors close their sockets on stop
+	for (auto& pReactor : _reactors)
+		pReactor->stop();
+	_reactors.clear();
+	_attachments.clear();
+	_resolver.stop();
+
+	::srt_cleanup();
+	_log.stop(); // after the SRT threads
+	_started = false;
+	INFO("SRT runtime stopped")
+}
+
+void SRTRuntime::add(const shared<Socket>& pSocket) {
+	lock_guard<mutex> lock(_mutex);
+	if (_reactors.empty()) {
+		ERROR("SRT runtime: not started, socket ignored")
+		return;
+	}
+	Reactor* pReactor = _reactors.front().get();
+	for (auto& pOther : _reactors) {
+		if (pOther->count() < pReactor->count())
+			pReactor = pOther.get();
+	}
+	_attachments[pSocket.get()] = pReactor;
+	pReactor->add(pSocket);
+}
+
+void SRTRuntime::remove(const shared<Socket>& pSocket) {
+	lock_guard<mutex> lock(_mutex);
+	const auto& it = _attachments.find(pSocket.get());
+	if (it == _attachments.end())
+		return;
+	it->second->remove(pSocket);
+	_attachments.erase(it);
+}
+
+bool SRTRuntime::resolve(const string& host, SocketAddress& address) {
+	return _resolver.resolve(host, address);
+}
+
+string& SRTRuntime::BuildName(const string& streamId, string& name) {
+
+	// Access control syntax : #!::key1=value1,key2=value2...
+	if (streamId.compare(0, 4, "#!::") == 0) {
+		size_t pos = 4;
+		while (pos < streamId.size()) {
+			size_t end = streamId.find(',', pos);
+			if (end == string::npos)
+				end = streamId.size();
+			if (streamId.compare(pos, 2, "r=") == 0)
+				return name.assign(streamId, pos + 2, end - pos - 2);
+			pos = end + 1;
+		}
+		return name;
+	}
+	return name.assign(streamId);
+}
+
+vector<string>& SRTRuntime::Split(const string& list, vector<string>& items) {
+	size_t pos = 0;
+	while (pos < list.size()) {
+		size_t end = list.find(',', pos);
+		if (end == string::npos)
+			end = list.size();
+		size_t first = list.find_first_not_of(" \t", pos);
+		size_t last = list.find_last_not_of(" \t", end - 1);
+		if (first < end && last != string::npos && last >= first)
+			items.emplace_back(list, first, last - first + 1);
+		pos = end + 1;
+	}
+	return items;
+}
+
+
+const UInt32 SRTRuntime::Tuning::MIN_PAYLOAD_SIZE;
+
+SRTRuntime::Tuning::Tuning(const Parameters& configs) : latency(configs.getNumber<UInt32, 0>("srt.latency")), maxBW(-1), inputBW(configs.getNumber<Int64, 0>("srt.inputBW")),
+	overheadBW(configs.getNumber<UInt32, 0>("srt.overheadBW")), sndBuf(configs.getNumber<UInt32, 0>("srt.sndBuf")), rcvBuf(configs.getNumber<UInt32, 0>("srt.rcvBuf")),
+	fc(configs.getNumber<UInt32, 0>("srt.fc")), payloadSize(configs.getNumber<UInt32, 0>("srt.payloadSize")), autoTuning(configs.getBoolean<false>("srt.autoTuning")) {
+	configs.getNumber("srt.maxBW", maxBW);
+	if (payloadSize && payloadSize < MIN_PAYLOAD_SIZE) {
+		WARN("srt.payloadSize ", payloadSize, " ignored, ", MIN_PAYLOAD_SIZE, " bytes at least to carry a payload of 7 TS packets")
+		payloadSize = 0;
+	}
+}
+
+string& SRTRuntime::Tuning::parse(string& address) {
+	size_t pos = address.find('?');
+	if (pos == string::npos)
+		return address;
+	string query(address, pos + 1);
+	address.resize(pos);
+
+	vector<string> params;
+	String::Split(query, "&", params, String::SPLIT_IGNORE_EMPTY | String::SPLIT_TRIM);
+	for (const string& param : params) {
+		size_t equal = param.find('=');
+		if (!set(param.substr(0, equal), equal == string::npos ? "" : param.substr(equal + 1)))
+			WARN("SRT ", address, ": invalid option ", param, " ignored")
+	}
+	return address;
+}
+
+bool SRTRuntime::Tuning::set(const string& key, const string& value) {
+	if (String::ICompare(key.c_str(), "latency") == 0)
+		return String::ToNumber(value, latency);
+	if (String::ICompare(key.c_str(), "maxBW") == 0)
+		return String::ToNumber(value, maxBW);
+	if (String::ICompare(key.c_str(), "inputBW") == 0)
+		return String::ToNumber(value, inputBW);
+	if (String::ICompare(key.c_str(), "overheadBW") == 0)
+		return String::ToNumber(value, overheadBW);
+	if (String::ICompare(key.c_str(), "sndBuf") == 0)
+		return String::ToNumber(value, sndBuf);
+	if (String::ICompare(key.c_str(), "rcvBuf") == 0)
+		return String::ToNumber(value, rcvBuf);
+	if (String::ICompare(key.c_str(), "fc") == 0)
+		return String::ToNumber(value, fc);
+	if (String::ICompare(key.c_str(), "payloadSize") == 0) {
+		UInt32 size;
+		if (!String::ToNumber(value, size) || (size && size < MIN_PAYLOAD_SIZE))
+			return false; // smaller than a payload
+		payloadSize = size;
+		return true;
+	}
+	if (String::ICompare(key.c_str(), "autoTuning") == 0) {
+		autoTuning = value != "false" && value != "0";
+		return true;
+	}
+	return false;
+}
+
+template<typename Type>
+static void SetOption(::SRTSOCKET socket, ::SRT_SOCKOPT option, const char* name, Type value) {
+	if (::srt_setsockflag(socket, option, &value, sizeof(value)) != 0)
+		ERROR("SRT ", name, " ", value, ": ", ::srt_getlasterror_str())
+}
+
+void SRTRuntime::Tuning::apply(::SRTSOCKET socket, double rtt, Int64 bitrate) const {
+	UInt32 latency = autoTuning && rtt > 0 ? latencyFor(rtt) : this->latency;
+	Int64 inputBW = !this->inputBW && autoTuning ? bitrate : this->inputBW;
+	Int64 maxBW = this->maxBW < 0 && autoTuning ? 0 : this->maxBW; // relative to inputBW in auto mode
+
+	// Flow control before the buffers, libsrt bounds the receiving buffer by it
+	if (fc)
+		SetOption<int>(socket, SRTO_FC, "SRTO_FC", fc);
+	if (sndBuf)
+		SetOption<int>(socket, SRTO_SNDBUF, "SRTO_SNDBUF", sndBuf);
+	if (rcvBuf)
+		SetOption<int>(socket, SRTO_RCVBUF, "SRTO_RCVBUF", rcvBuf);
+	if (payloadSize)
+		SetOption<int>(socket, SRTO_PAYLOADSIZE, "SRTO_PAYLOADSIZE", payloadSize);
+	if (latency)
+		SetOption<int>(socket, SRTO_LATENCY, "SRTO_LATENCY", latency);
+	if (inputBW)
+		SetOption<int64_t>(socket, SRTO_INPUTBW, "SRTO_INPUTBW", inputBW);
+	if (overheadBW)
+		SetOption<int>(socket, SRTO_OHEADBW, "SRTO_OHEADBW", overheadBW);
+	if (maxBW >= 0)
+		SetOption<int64_t>(socket, SRTO_MAXBW, "SRTO_MAXBW", maxBW);
+	DEBUG("SRT socket ", socket, " tuning: latency ", latency, "ms, inputBW ", inputBW, ", maxBW ", maxBW)
+}
+
+UInt32 SRTRuntime::Tuning::latencyFor(double rtt) const {
+	return max(latency ? latency : 120, UInt32(4 * rtt)); // 120ms is the libsrt default
+}
+
+
+SRTRuntime::Reactor::Reactor(SRTRuntime& runtime, UInt16 index) : Thread("SRTReactor"), runtime(runtime), _count(0), _epollid(-1) {
+}
+
+SRTRuntime::Reactor::~Reactor() {
+	Thread::stop();
+}
+
+void SRTRuntime::Reactor::add(const shared<Socket>& pSocket) {
+	lock_guard<mutex> lock(_mutex);
+	_adding.emplace_back(pSocket);
+	++_count;
+}
+
+void SRTRuntime::Reactor::remove(const shared<Socket>& pSocket) {
+	lock_guard<mutex> lock(_mutex);
+	_removing.emplace_back(pSocket);
+	--_count;
+}
+
+bool SRTRuntime::Reactor::watch(::SRTSOCKET socket, Socket& owner, int events) {
+	int result = _owners.count(socket) ? ::srt_epoll_update_usock(_epollid, socket, &events) : ::srt_epoll_add_usock(_epollid, socket, &events);
+	if (result != 0) {
+		ERROR("SRT reactor: error adding socket to poll set; ", ::srt_getlasterror_str())
+		return false;
+	}
+	_owners[socket] = &owner;
+	return true;
+}
+
+void SRTRuntime::Reactor::unwatch(::SRTSOCKET socket) {
+	if (!_owners.erase(socket))
+		return;
+	DEBUG("Remove socket from poll; ", (int)socket);
+	::srt_epoll_remove_usock(_epollid, socket);
+}
+
+bool SRTRuntime::Reactor::run(Exception&, const volatile bool& requestStop) {
+
+	_epollid = ::srt_epoll_create();
+	if (_epollid < 0) {
+		ERROR("Error initializing UDT epoll set;", ::srt_getlasterror_str());
+		return false;
+	}
+
+	while (!requestStop) {
+		{
+			lock_guard<mutex> lock(_mutex);
+			for (auto& pSocket : _adding)
+				_sockets.emplace(pSocket);
+			_adding.clear();
+			for (auto& pSocket : _removing) {
+				if (_sockets.erase(pSocket))
+					pSocket->onClose(*this);
+			}
+			_removing.clear();
+		}
+
+		Int64 now = Time::Now();
+		for (const shared<Socket>& pSocket : _sockets)
+			pSocket->onManage(*this, now);
+
+		if (_owners.empty()) {
+			// SRT can't wait on an empty epoll set
+			Sleep(TICK);
+			continue;
+		}
+
+		_readSockets.resize(_owners.size());
+		_writeSockets.resize(_owners.size());
+		int rfdn = (int)_readSockets.size();
+		int wfdn = (int)_writeSockets.size();
+		if (::srt_epoll_wait(_epollid, _readSockets.data(), &rfdn, _writeSockets.data(), &wfdn, TICK, nullptr, nullptr, nullptr, nullptr) <= 0)
+			continue; // timeout
+
+		for (int i = 0; i < rfdn; ++i) {
+			const auto& it = _owners.find(_readSockets[i]);
+			if (it != _owners.end())
+				it->second->onReadable(*this, it->first);
+		}
+		for (int i = 0; i < wfdn; ++i) {
+			const auto& it = _owners.find(_writeSockets[i]);
+			if (it != _owners.end())
+				it->second->onWritable(*this, it->first);
+		}
+	}
+
+	// Close all the sockets still attached
+	{
+		lock_guard<mutex> lock(_mutex);
+		for (auto& pSocket : _adding)
+			_sockets.emplace(pSocket);
+		_adding.clear();
+		_removing.clear();
+	}
+	for (const shared<Socket>& pSocket : _sockets)
+		pSocket->onClose(*this);
+	_sockets.clear();
+	_owners.clear();
+
+	::srt_epoll_release(_epollid);
+	_epollid = -1;
+	return true;
+}
+
+
+bool SRTRuntime::Resolver::resolve(const string& host, SocketAddress& address) {
+	lock_guard<mutex> lock(_mutex);
+	Entry& entry = _entries[host];
+	if (!entry.pending && (!entry.time || (Time::Now() - entry.time) >= (entry.resolved ? Int64(_ttl) : resolveRetryMS))) {
+		entry.pending = true;
+		_requests.emplace_back(host);
+		_wakeUp.set();
+	}
+	if (!entry.resolved)
+		return false;
+	address = entry.address;
+	return true;
+}
+
+void SRTRuntime::Resolver::stop() {
+	_wakeUp.set();
+	Thread::stop();
+}
+
+bool SRTRuntime::Resolver::run(Exception&, const volatile bool& requestStop) {
+	while (!requestStop) {
+		string host;
+		{
+			lock_guard<mutex> lock(_mutex);
+			if (!_requests.empty()) {
+				host = move(_requests.front());
+				_requests.pop_front();
+			}
+		}
+		if (host.empty()) {
+			_wakeUp.wait(1000);
+			continue;
+		}
+
+		// Blocking resolution out of the lock
+		SocketAddress address;
+		Exception ex;
+		bool resolved = address.set(ex, host) && address.family() == IPAddress::IPv4;
+
+		lock_guard<mutex> lock(_mutex);
+		Entry& entry = _entries[host];
+		entry.pending = false;
+		entry.time = Time::Now();
+		if (resolved) {
+			entry.address = address;
+			entry.resolved = true;
+		} else if (entry.resolved)
+			WARN("SRT runtime: can't refresh ", host, " resolution, ", entry.address, " kept")
+		else
+			ERROR("SRT runtime: can't resolve target host, ", host)
+	}
+	return true;
+}
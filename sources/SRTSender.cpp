@@ -0,0 +1,293 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "SRTSender.h"
+#include "Mona/Logs.h"
+#include "Mona/String.h"
+
+using namespace Mona;
+using namespace std;
+
+const UInt32 SRTSender::DROP_GOP_TIMEOUT;
+
+SRTSender::Options::Options(const Parameters& configs) : queueSize(configs.getNumber<UInt32, 4096>("srt.sendQueue")),
+	ttl(configs.getNumber<UInt32, 0>("srt.ttl")), congestion(configs.getBoolean<true>("srt.congestion")),
+	pacing(configs.getNumber<UInt32, 50>("srt.pacing")), paceDelay(configs.getNumber<UInt32, 100>("srt.paceDelay")),
+	sourceTime(configs.getBoolean<false>("srt.sourceTime")), tuning(configs),
+	maxRTT(max<UInt32>(1, configs.getNumber<UInt32, 500>("srt.maxRTT"))), maxLoss(max<UInt32>(1, configs.getNumber<UInt32, 5>("srt.maxLoss"))),
+	failoverScore(configs.getNumber<UInt32, 50>("srt.failoverScore")), failoverHysteresis(configs.getNumber<UInt32, 20>("srt.failoverHysteresis")),
+	failoverHold(configs.getNumber<UInt32, 10000>("srt.failoverHold")) {
+}
+
+string& SRTSender::Options::parse(string& target) {
+	vector<string> hosts;
+	String::Split(target, "|", hosts, String::SPLIT_IGNORE_EMPTY | String::SPLIT_TRIM);
+	target.clear();
+	for (string& host : hosts)
+		String::Append(target, target.empty() ? "" : "|", tuning.parse(host));
+	return target;
+}
+
+SRTSender::SRTSender(const Options& options, const shared<SRTStats::Series>& pStats) : pStats(pStats), _connectedSocket(::SRT_INVALID_SOCK), _switching(::SRT_INVALID_SOCK), _options(options), _joining(false), _sending(false), _queue(options.queueSize),
+	_congestion(CONGESTION_NONE), _bytes(0), _queuedBytes(0), _pacingRate(0), _pacedMax(0), _startTime(0), _tokens(0), _paced(false), _srcTime(0), _srcStart(0), _rtt(0), _bitrate(0), _inputBW(0), _rateTime(0), _rateBytes(0), _droppingGOP(false) {
+}
+
+bool SRTSender::write(const TSPacker::Payload& payload) {
+	chrono::steady_clock::time_point start(chrono::steady_clock::now());
+	_bytes.fetch_add(payload.size(), memory_order_relaxed);
+	// Keyframe-aligned switch, the new socket starts on this GOP
+	if ((payload.flags & TSPacker::FLAG_KEY) && _switching.load(memory_order_relaxed) != ::SRT_INVALID_SOCK) {
+		::SRTSOCKET socket = _switching.exchange(::SRT_INVALID_SOCK, memory_order_acq_rel);
+		if (socket != ::SRT_INVALID_SOCK && _connectedSocket.load(memory_order_acquire) != ::SRT_INVALID_SOCK) {
+			_startTime.store(::srt_time_now(), memory_order_relaxed);
+			_connectedSocket.store(socket, memory_order_release);
+		}
+	}
+
+	bool queued = false;
+	if (_connectedSocket.load(memory_order_acquire) == ::SRT_INVALID_SOCK) {
+		++_drops.disconnected;
+		if ((false)) {
+			DEBUG("SRT: Drop packet while NOT CONNECTED")
+		}
+	} else if (_joining) {
+		++_drops.joining;
+		if ((false)) {
+			DEBUG("SRT: Drop packet while waiting the cached GOP")
+		}
+	} else if (congested(payload)) {
+		if ((false)) {
+			DEBUG("SRT: Drop packet on congestion")
+		}
+	} else if (!(queued = _queue.push(Stamp(payload)))) {
+		++_drops.full;
+		if ((false)) {
+			DEBUG("SRT: Drop packet, sending queue full")
+		}
+	} else {
+		_queuedBytes.fetch_add(payload.size(), memory_order_relaxed);
+		flush();
+	}
+
+	_writeLatency.record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+	return queued;
+}
+
+TSPacker::Payload SRTSender::Stamp(const TSPacker::Payload& payload) {
+	TSPacker::Payload queued(payload);
+	LATENCY_STAMP(queued.stamp);
+	return queued;
+}
+
+bool SRTSender::congested(const TSPacker::Payload& payload) {
+	UInt8 congestion = _congestion.load(memory_order_relaxed);
+	if (_droppingGOP) {
+		// Resume on a GOP start once the severe congestion is over, or after DROP_GOP_TIMEOUT if no keyframe comes
+		if (congestion < CONGESTION_SEVERE && ((payload.flags & TSPacker::FLAG_KEY) || chrono::steady_clock::now() - _droppingTime >= chrono::milliseconds(DROP_GOP_TIMEOUT)))
+			_droppingGOP = false;
+	} else if (congestion >= CONGESTION_SEVERE) {
+		_droppingGOP = true;
+		_droppingTime = chrono::steady_clock::now();
+	}
+
+	// Audio and program tables are always sent
+	if (payload.flags & (TSPacker::FLAG_AUDIO | TSPacker::FLAG_PSI))
+		return false;
+	if (_droppingGOP) {
+		++_drops.gop;
+		return true;
+	}
+	if (congestion >= CONGESTION_MODERATE && payload.flags == TSPacker::FLAG_DISPOSABLE) {
+		++_drops.disposable;
+		return true;
+	}
+	return false;
+}
+
+void SRTSender::join(const deque<TSPacker::Payload>& gop) {
+	// _joining is set before _connectedSocket, so a connected socket can't lose its GOP
+	if (!connected() || !_joining)
+		return;
+	_joining = false;
+	_droppingGOP = false;
+	// Without source time: the cached GOP is late, the receiver has to deliver it at once
+	for (const TSPacker::Payload& payload : gop)
+		write(TSPacker::Payload(payload, payload.flags));
+}
+
+void SRTSender::activate(::SRTSOCKET socket) {
+	_switching.store(::SRT_INVALID_SOCK, memory_order_release);
+	_congestion = CONGESTION_NONE;
+	_inputBW = 0; // new socket
+	_startTime.store(::srt_time_now(), memory_order_relaxed);
+	_joining = true;
+	_connectedSocket.store(socket, memory_order_release);
+}
+
+void SRTSender::control(Int64 now) {
+	::SRTSOCKET socket = _connectedSocket.load(memory_order_acquire);
+	if (socket == ::SRT_INVALID_SOCK)
+		return;
+
+	::SRT_TRACEBSTATS stats;
+	if (::srt_bstats(socket, &stats, 0) < 0)
+		return;
+	_drops.ttl = max(stats.pktSndDropTotal, 0);
+	if (stats.msRTT > 0)
+		_rtt = stats.msRTT;
+	measure(socket, now);
+	if (pStats && pStats->due(now))
+		pStats->sample(stats, now, _drops.full + _drops.disposable + _drops.gop, NULL, _pacedMax.exchange(0, memory_order_relaxed) / 1000.0);
+	if (!_options.congestion)
+		return;
+
+	// Data waiting in the SRT sending buffer compared to the latency window, and queue filling
+	int latency = 0;
+	int size = sizeof(latency);
+	if (::srt_getsockflag(socket, SRTO_PEERLATENCY, &latency, &size) < 0 || latency <= 0)
+		latency = 120; // SRT default
+	UInt32 queued = _queue.size();
+	UInt8 congestion = _congestion;
+	if (stats.msSndBuf > latency || queued > _queue.capacity() / 2)
+		congestion = CONGESTION_SEVERE;
+	else if (stats.msSndBuf > latency / 2 || queued > _queue.capacity() / 4)
+		congestion = max<UInt8>(congestion, CONGESTION_MODERATE);
+	else if (stats.msSndBuf < latency / 4 && queued < _queue.capacity() / 8)
+		congestion = CONGESTION_NONE; // hysteresis, the level decreases only once the buffers are almost empty
+	if (congestion == _congestion)
+		return;
+	if (congestion > _congestion)
+		WARN("SRT congestion level ", UInt16(congestion), ", ", stats.msSndBuf, "ms in sending buffer (latency ", latency, "ms), ", queued, " payloads queued")
+	else
+		INFO("SRT congestion level ", UInt16(congestion), ", ", _drops.disposable, " non-reference and ", _drops.gop, " GOP payloads dropped")
+	_congestion = congestion;
+}
+
+void SRTSender::measure(::SRTSOCKET socket, Int64 now) {
+	UInt64 bytes = _bytes.load(memory_order_relaxed);
+	if (!_rateTime || now < _rateTime) {
+		_rateTime = now;
+		_rateBytes = bytes;
+		return;
+	}
+	if (now - _rateTime < 1000)
+		return;
+	Int64 rate = Int64((bytes - _rateBytes) * 1000 / (now - _rateTime));
+	_rateTime = now;
+	_rateBytes = bytes;
+	_bitrate = _bitrate ? (_bitrate * 3 + rate) / 4 : rate;
+	if (_options.pacing)
+		_pacingRate.store(_bitrate * (100 + _options.pacing) / 100, memory_order_relaxed);
+	if (!_options.tuning.autoTuning)
+		return;
+
+	// SRTO_INPUTBW can be changed while connected, only on a significant change (20%) and if not configured
+	if (_options.tuning.inputBW || !_bitrate || (_inputBW && (_bitrate > _inputBW ? _bitrate - _inputBW : _inputBW - _bitrate) * 5 < _inputBW))
+		return;
+	if (::srt_setsockflag(socket, SRTO_INPUTBW, &_bitrate, sizeof(_bitrate)) != 0) {
+		WARN("SRT SRTO_INPUTBW: ", ::srt_getlasterror_str())
+		return;
+	}
+	DEBUG("SRT socket ", socket, " SRTO_INPUTBW ", _bitrate, " bytes/s")
+	_inputBW = _bitrate;
+}
+
+bool SRTSender::pace(const TSPacker::Payload& payload) {
+	Int64 rate = _pacingRate.load(memory_order_relaxed);
+	if (!rate)
+		return true; // bitrate not measured yet
+
+	// Refill, the bucket holds two reactor ticks: the reactor flushes the paced queue at least every tick
+	chrono::steady_clock::time_point now(chrono::steady_clock::now());
+	Int64 elapsed = min<Int64>(chrono::duration_cast<chrono::microseconds>(now - _tokensTime).count(), 1000000);
+	_tokensTime = now;
+	_tokens = min(_tokens + rate * elapsed / 1000000, rate * SRTRuntime::TICK * 2 / 1000 + Int64(payload.size()));
+
+	if (_tokens >= Int64(payload.size()))
+		_tokens -= payload.size();
+	else if (Int64(_queuedBytes.load(memory_order_relaxed)) * 1000 < rate * _options.paceDelay) {
+		if (!_paced) {
+			_paced = true;
+			_pacedTime = now;
+		}
+		return false;
+	} else
+		_tokens = 0; // queue above the maximum delay, sent without pacing
+
+	if (_paced) {
+		_paced = false;
+		UInt64 delay = chrono::duration_cast<chrono::microseconds>(now - _pacedTime).count();
+		_pacingDelay.record(delay);
+		UInt64 max = _pacedMax.load(memory_order_relaxed);
+		while (delay > max && !_pacedMax.compare_exchange_weak(max, delay, memory_order_relaxed));
+	}
+	return true;
+}
+
+Int64 SRTSender::sourceTime(const TSPacker::Payload& payload) {
+	// libsrt refuses a srctime in the future or before the start of the socket, without source time the payload is timed now
+	Int64 start = _startTime.load(memory_order_relaxed);
+	if (start != _srcStart) {
+		_srcStart = start;
+		_srcTime = start; // new socket
+	}
+	Int64 now = ::srt_time_now();
+	_srcTime = max(_srcTime, payload.time ? min(payload.time, now) : now);
+	return _srcTime;
+}
+
+void SRTSender::flush() {
+	if (_sending.exchange(true, memory_order_acquire))
+		return; // already sending on an other thread
+
+	while (TSPacker::Payload* pPayload = _queue.front()) {
+		// Loaded for each payload: the reactor can switch or disconnect the socket while this thread is sending
+		::SRTSOCKET socket = _connectedSocket.load(memory_order_acquire);
+		if (socket != ::SRT_INVALID_SOCK) {
+			// Stale payloads are discarded inside SRT, the most important ones get more time
+			::SRT_MSGCTRL control = ::srt_msgctrl_default;
+			if (_options.ttl)
+				control.msgttl = (pPayload->flags & (TSPacker::FLAG_AUDIO | TSPacker::FLAG_PSI | TSPacker::FLAG_KEY)) ? _options.ttl * 2 : _options.ttl;
+			control.inorder = 1;
+			if (_options.sourceTime)
+				control.srctime = sourceTime(*pPayload);
+			if (_options.pacing && !pace(*pPayload))
+				break; // sent on the next flush
+			LATENCY_FIELD(stamp);
+			LATENCY_STAMP(stamp);
+			if (::srt_sendmsg2(socket, (const char*)pPayload->data(), pPayload->size(), &control) < 0) {
+				if (_options.pacing && _pacingRate.load(memory_order_relaxed))
+					_tokens += pPayload->size(); // not sent
+				if (::srt_getlasterror(NULL) == SRT_EASYNCSND)
+					break; // SRT buffer full: keep the queue, sent on the next flush
+				// Payload refused (link broken, invalid size...): drop it, otherwise the queue would stall on it
+				++_drops.errors;
+				chrono::steady_clock::time_point now(chrono::steady_clock::now());
+				if (now - _errorTime >= chrono::seconds(1)) {
+					_errorTime = now;
+					WARN("SRT send error, payload dropped (", _drops.errors, " in total); ", ::srt_getlasterror_str())
+				}
+			} else {
+				LATENCY_RECORD(STAGE_SEND, stamp);
+				LATENCY_RECORD(STAGE_SEND_QUEUE, pPayload->stamp);
+			}
+		} else
+			++_drops.disconnected;
+		_queuedBytes.fetch_sub(pPayload->size(), memory_order_relaxed);
+		_queue.pop();
+	}
+
+	_sending.store(false, memory_order_release);
+}
@@ -0,0 +1,278 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "SRTServer.h"
+#include "Mona/Logs.h"
+#include <algorithm>
+
+using namespace Mona;
+using namespace std;
+
+static const int StreamIdMaxSize = 512;
+
+SRTServer::SRTServer(const Parameters& configs, ServerAPI& api, SRTRuntime& runtime, SRTStats& stats) : _api(api), _runtime(runtime), _stats(stats), _backlog(32), _options(configs), _started(false),
+	_holdDelay(configs.getNumber<UInt32, 5>("srt.holdDelay")),
+	_frameQueue(configs.getNumber<UInt32, 1024>("srt.frameQueue")),
+	_gopCache(configs.getNumber<UInt32, 0x400000>("srt.gopCache")),
+	_configInterval(configs.getNumber<UInt32, 0>("srt.configInterval")) {
+	_onSubscribe = [this](shared<Subscriber>& pSubscriber) {
+		if (!_started)
+			return; // stopped meanwhile, the listener closes its subscribers
+		Mona::unique<Feed>& pFeed = _feeds[pSubscriber->name];
+		if (!pFeed) {
+			pFeed.reset(new Feed(_api, _holdDelay, _frameQueue, _gopCache, _configInterval, _options.sourceDrift()));
+			Exception ex;
+			if (!_api.subscribe(ex, pSubscriber->name, pFeed->subscription)) {
+				ERROR("SRT subscribe to ", pSubscriber->name, ": ", ex)
+				_feeds.erase(pSubscriber->name);
+				::srt_close(pSubscriber->socket); // the reactor will release the subscriber on its next loop
+				return;
+			}
+			NOTE("SRT subscribe to ", pSubscriber->name)
+		}
+		pFeed->add(pSubscriber);
+	};
+	_onUnsubscribe = [this](shared<Subscriber>& pSubscriber) {
+		const auto& it = _feeds.find(pSubscriber->name);
+		if (it == _feeds.end() || it->second->remove(pSubscriber))
+			return;
+		NOTE("SRT unsubscribe to ", pSubscriber->name)
+		_feeds.erase(it);
+	};
+
+	// The query of the listening address overrides the transport options of the subscribers (0.0.0.0:4902?latency=300...)
+	_host.assign(configs.getString("srt.listen", ""));
+	_options.tuning.parse(_host);
+	configs.getNumber("srt.backlog", _backlog);
+}
+
+SRTServer::~SRTServer() {
+	stop();
+}
+
+bool SRTServer::start() {
+	if (_started)
+		return true;
+
+	SocketAddress address;
+	Exception ex;
+	if (!address.set(ex, _host) || address.family() != IPAddress::IPv4) {
+		ERROR("SRTServer start: can't resolve listening host, ", _host)
+		return false;
+	}
+	_started = true;
+
+	_pListener.reset(new Listener(*this, address));
+	_runtime.add(_pListener);
+	return true;
+}
+
+void SRTServer::stop() {
+	if (!_started)
+		return;
+	_started = false;
+
+	_runtime.remove(_pListener); // sockets closed by the reactor
+	_pListener.reset();
+	_feeds.clear();
+}
+
+
+void SRTServer::Subscriber::close() {
+	// Writers drop their payloads from now
+	_connectedSocket = ::SRT_INVALID_SOCK;
+	flush(); // drop the queue if not sending
+}
+
+
+SRTServer::Listener::Listener(SRTServer& server, const SocketAddress& address) : address(address), _handler(server._api.handler), _stats(server._stats), _backlog(server._backlog), _options(server._options),
+	_socket(::SRT_INVALID_SOCK), _onSubscribe(server._onSubscribe), _onUnsubscribe(server._onUnsubscribe) {
+}
+
+void SRTServer::Listener::onManage(SRTRuntime::Reactor& reactor, Int64 now) {
+	if (_socket == ::SRT_INVALID_SOCK && !listen(reactor))
+		return;
+
+	for (auto it = _subscribers.begin(); it != _subscribers.end();) {
+		shared<Subscriber> pSubscriber((it++)->second);
+		if (::srt_getsockstate(pSubscriber->socket) == ::SRTS_CONNECTED)
+			pSubscriber->send(now); // the SRT sending buffer has maybe some room now
+		else
+			close(reactor, pSubscriber);
+	}
+}
+
+void SRTServer::Listener::onReadable(SRTRuntime::Reactor& reactor, ::SRTSOCKET socket) {
+	if (socket == _socket)
+		return accept(reactor);
+
+	const auto& it = _subscribers.find(socket);
+	if (it == _subscribers.end())
+		return;
+	if (::srt_getsockstate(socket) != ::SRTS_CONNECTED)
+		return close(reactor, it->second);
+	// Discard incoming data
+	char buf[1500];
+	while (::srt_recvmsg(socket, &buf[0], sizeof(buf)) > 0)
+		continue;
+}
+
+void SRTServer::Listener::onClose(SRTRuntime::Reactor& reactor) {
+	while (!_subscribers.empty())
+		close(reactor, _subscribers.begin()->second);
+
+	if (_socket == ::SRT_INVALID_SOCK)
+		return;
+	reactor.unwatch(_socket);
+	::srt_close(_socket);
+	_socket = ::SRT_INVALID_SOCK;
+}
+
+bool SRTServer::Listener::listen(SRTRuntime::Reactor& reactor) {
+	NOTE("Starting SRT output server on host ", address)
+
+	::SRTSOCKET socket = ::srt_socket(AF_INET, SOCK_DGRAM, 0);
+	if (socket == ::SRT_INVALID_SOCK) {
+		ERROR("SRTServer create socket: ", ::srt_getlasterror_str());
+		return false;
+	}
+
+	// Non-blocking listener, accepted sockets inherit these options
+	bool block = false;
+	if (::srt_setsockopt(socket, 0, SRTO_RCVSYN, &block, sizeof(block)) != 0 || ::srt_setsockopt(socket, 0, SRTO_SNDSYN, &block, sizeof(block)) != 0) {
+		ERROR("SRTServer SRTO_RCVSYN/SRTO_SNDSYN: ", ::srt_getlasterror_str());
+		::srt_close(socket);
+		return false;
+	}
+	_options.tuning.apply(socket); // the subscribers follow their bitrate in auto mode
+
+	// SRT support only IPV4 so we convert to a sockaddr_in
+	sockaddr addr;
+	memcpy(&addr, address.data(), sizeof(sockaddr)); // WARN: work only with ipv4 addresses
+	addr.sa_family = AF_INET;
+	if (::srt_bind(socket, &addr, sizeof(sockaddr)) || ::srt_listen(socket, _backlog) || !reactor.watch(socket, *this, SRT_EPOLL_IN | SRT_EPOLL_ERR)) {
+		ERROR("SRTServer listen: ", ::srt_getlasterror_str());
+		::srt_close(socket);
+		return false;
+	}
+	_socket = socket;
+	return true;
+}
+
+void SRTServer::Listener::accept(SRTRuntime::Reactor& reactor) {
+
+	for (;;) {
+		sockaddr_in scl;
+		int sclen = sizeof scl;
+		::SRTSOCKET socket = ::srt_accept(_socket, (sockaddr*)&scl, &sclen);
+		if (socket == SRT_INVALID_SOCK) {
+			// EAGAIN, no more pending connection
+			if (::srt_getlasterror(NULL) != SRT_EASYNCRCV)
+				ERROR("SRTServer accept: ", ::srt_getlasterror_str());
+			return;
+		}
+
+		char streamId[StreamIdMaxSize];
+		int size = sizeof(streamId);
+		if (::srt_getsockflag(socket, SRTO_STREAMID, streamId, &size) != 0)
+			size = 0;
+		string name;
+		if (SRTRuntime::BuildName(string(streamId, size), name).empty()) {
+			WARN("SRT subscriber from ", SocketAddress(*((sockaddr*)(&scl))), " rejected, no publication name in its streamid")
+			::srt_close(socket);
+			continue;
+		}
+
+		if (!reactor.watch(socket, *this, SRT_EPOLL_IN | SRT_EPOLL_ERR)) {
+			::srt_close(socket);
+			continue;
+		}
+		shared<Subscriber> pSubscriber(new Subscriber(_options, _stats.add(name, "subscriber"), socket, name));
+		_subscribers.emplace(socket, pSubscriber);
+
+		INFO("SRT subscriber from ", SocketAddress(*((sockaddr*)(&scl))), " to ", name)
+
+		// Subscribe to the publication (switch thread to main thread)
+		_handler.queue(_onSubscribe, pSubscriber);
+	}
+}
+
+void SRTServer::Listener::close(SRTRuntime::Reactor& reactor, const shared<Subscriber>& pSubscriber) {
+	pSubscriber->close();
+	_stats.remove(pSubscriber->pStats);
+	reactor.unwatch(pSubscriber->socket);
+	::srt_close(pSubscriber->socket);
+	_subscribers.erase(pSubscriber->socket);
+	INFO("SRT subscriber ", pSubscriber->socket, " to ", pSubscriber->name, " disconnected")
+
+	// Remove it from its feed (switch thread to main thread)
+	_handler.queue(_onUnsubscribe, pSubscriber);
+}
+
+
+SRTServer::Feed::Feed(ServerAPI& api, UInt32 holdDelay, UInt32 frameQueue, UInt32 gopCache, UInt32 configInterval, UInt32 sourceDrift) : subscription(*this), _api(api), _holdDelay(holdDelay),
+	_pMux(new TSMux(api.threadPool, holdDelay, frameQueue, gopCache, configInterval, sourceDrift)), _ppSubscribers(new shared<const Subscribers>(new Subscribers())) {
+
+	// Called on the worker thread, it must not reference the feed
+	// A new subscriber starts with the cached GOP
+	shared<shared<const Subscribers>> ppSubscribers(_ppSubscribers);
+	TSMux* pMux(_pMux.get());
+	_pMux->onPayload = [ppSubscribers, pMux](const TSPacker::Payload& payload) {
+		shared<const Subscribers> pSubscribers(atomic_load(ppSubscribers.get()));
+		for (const shared<Subscriber>& pSubscriber : *pSubscribers) {
+			pSubscriber->join(pMux->gop());
+			pSubscriber->write(payload);
+		}
+	};
+	_onFlush = [this](UInt32 delay) -> UInt32 {
+		_pMux->flush();
+		return 0;
+	};
+}
+
+SRTServer::Feed::~Feed() {
+	_api.timer.remove(_onFlush);
+	_api.unsubscribe(subscription);
+	_pMux->reset();
+}
+
+void SRTServer::Feed::add(const shared<Subscriber>& pSubscriber) {
+	shared<Subscribers> pSubscribers(new Subscribers(*atomic_load(_ppSubscribers.get())));
+	pSubscribers->emplace_back(pSubscriber);
+	atomic_store(_ppSubscribers.get(), shared<const Subscribers>(pSubscribers));
+}
+
+bool SRTServer::Feed::remove(const shared<Subscriber>& pSubscriber) {
+	shared<Subscribers> pSubscribers(new Subscribers(*atomic_load(_ppSubscribers.get())));
+	pSubscribers->erase(std::remove(pSubscribers->begin(), pSubscribers->end(), pSubscriber), pSubscribers->end());
+	atomic_store(_ppSubscribers.get(), shared<const Subscribers>(pSubscribers));
+	return !pSubscribers->empty();
+}
+
+bool SRTServer::Feed::writeAudio(UInt16 track, const Media::Audio::Tag& tag, const Packet& packet, bool reliable) {
+	if (_pMux->writeAudio(track, tag, packet) && _holdDelay)
+		_api.timer.set(_onFlush, _holdDelay);
+	return true;
+}
+
+bool SRTServer::Feed::writeVideo(UInt16 track, const Media::Video::Tag& tag, const Packet& packet, bool reliable) {
+	if (_pMux->writeVideo(track, tag, packet) && _holdDelay)
+		_api.timer.set(_onFlush, _holdDelay);
+	return true;
+}
+
+void SRTServer::Feed::endMedia() {
+	_pMux->reset();
+}
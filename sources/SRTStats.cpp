@@ -0,0 +1,280 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "SRTStats.h"
+#include "Mona/Logs.h"
+#include "Mona/String.h"
+#include "Mona/Time.h"
+#include <fstream>
+#include <cstdio>
+
+using namespace Mona;
+using namespace std;
+
+SRTStats::Series::Series(UInt32 id, const string& name, const char* type, UInt32 period, UInt32 capacity) : id(id), name(name), type(type), period(period), deliveryJitter(0),
+	_slots(max<UInt32>(1, capacity)), _count(0), _time(0) {
+}
+
+void SRTStats::Series::sample(::SRTSOCKET socket, Int64 now, UInt64 dropped, const TSInspector::Health* pHealth) {
+	if (!due(now))
+		return;
+	::SRT_TRACEBSTATS stats;
+	if (::srt_bstats(socket, &stats, 0) == 0)
+		sample(stats, now, dropped, pHealth);
+}
+
+void SRTStats::Series::sample(const ::SRT_TRACEBSTATS& stats, Int64 now, UInt64 dropped, const TSInspector::Health* pHealth, double pacing) {
+	if (!due(now))
+		return;
+	_time = now;
+
+	UInt32 count = _count.load(memory_order_relaxed);
+	Slot& slot = _slots[count % _slots.size()];
+	UInt32 sequence = slot.sequence.load(memory_order_relaxed);
+	slot.sequence.store(sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	// Interval values from the totals: the libsrt interval counters would be averages since the connection without clearing
+	if (stats.msTimeStamp < _totals.time || stats.byteSentTotal < _totals.sentBytes || stats.byteRecvTotal < _totals.recvBytes)
+		_totals = Totals(); // new socket
+	Int64 elapsed = stats.msTimeStamp - _totals.time;
+	Int64 sent = stats.pktSentTotal - _totals.sent;
+	Int64 lost = stats.pktRcvLossTotal - _totals.recvLoss;
+	Int64 expected = stats.pktRecvTotal - _totals.received + lost;
+
+	Sample& sample = slot.sample;
+	sample.time = now;
+	sample.rtt = stats.msRTT;
+	sample.sendRate = elapsed > 0 ? (stats.byteSentTotal - _totals.sentBytes) * 8 / (elapsed * 1000.0) : 0;
+	sample.recvRate = elapsed > 0 ? (stats.byteRecvTotal - _totals.recvBytes) * 8 / (elapsed * 1000.0) : 0;
+	sample.sendLossRate = sent > 0 ? 100.0 * (stats.pktSndLossTotal - _totals.sendLoss) / sent : 0;
+	sample.recvLossRate = expected > 0 ? 100.0 * lost / expected : 0;
+	sample.sent = stats.pktSentTotal;
+	sample.received = stats.pktRecvTotal;
+	sample.sendLoss = stats.pktSndLossTotal;
+	sample.recvLoss = stats.pktRcvLossTotal;
+	sample.retransmitted = stats.pktRetransTotal;
+	sample.sendDrop = stats.pktSndDropTotal;
+	sample.recvDrop = stats.pktRcvDropTotal;
+	sample.sendBuffer = stats.msSndBuf;
+	sample.recvBuffer = stats.msRcvBuf;
+	sample.dropped = dropped;
+	sample.pacing = pacing;
+	sample.delivery = delivery.percentile(0.99) / 1000.0;
+	sample.deliveryJitter = deliveryJitter / 1000;
+	sample.ts = pHealth ? *pHealth : TSInspector::Health();
+
+	slot.sequence.store(sequence + 2, memory_order_release);
+	_count.store(count + 1, memory_order_release);
+
+	_totals.time = stats.msTimeStamp;
+	_totals.sentBytes = stats.byteSentTotal;
+	_totals.recvBytes = stats.byteRecvTotal;
+	_totals.sent = stats.pktSentTotal;
+	_totals.received = stats.pktRecvTotal;
+	_totals.sendLoss = stats.pktSndLossTotal;
+	_totals.recvLoss = stats.pktRcvLossTotal;
+}
+
+UInt32 SRTStats::Series::read(vector<Sample>& samples, UInt32 count) const {
+	UInt32 end = _count.load(memory_order_acquire);
+	UInt32 begin = end - min<UInt32>(min<UInt32>(count, end), _slots.size());
+	for (UInt32 i = begin; i < end; ++i) {
+		const Slot& slot = _slots[i % _slots.size()];
+		for (;;) {
+			UInt32 sequence = slot.sequence.load(memory_order_acquire);
+			if (sequence & 1)
+				continue; // being written
+			Sample sample(slot.sample);
+			atomic_thread_fence(memory_order_acquire);
+			if (slot.sequence.load(memory_order_relaxed) != sequence)
+				continue;
+			samples.emplace_back(sample);
+			break;
+		}
+	}
+	return end - begin;
+}
+
+
+SRTStats::SRTStats(const Parameters& configs) : period(max<UInt32>(100, configs.getNumber<UInt32, 1000>("srt.statsPeriod"))),
+	history(max<UInt32>(1, configs.getNumber<UInt32, 60>("srt.statsHistory"))),
+	_nextId(0), _exportHistory(1), _export(configs.getBoolean<true>("srt.statsExport")) {
+	configs.getNumber("srt.statsExportHistory", _exportHistory);
+}
+
+shared<SRTStats::Series> SRTStats::add(const string& name, const char* type) {
+	lock_guard<mutex> lock(_mutex);
+	shared<Series> pSeries(new Series(++_nextId, name, type, period, history));
+	_series.emplace(pSeries);
+	return pSeries;
+}
+
+void SRTStats::remove(const shared<Series>& pSeries) {
+	lock_guard<mutex> lock(_mutex);
+	_series.erase(pSeries);
+}
+
+string& SRTStats::writeJSON(string& out, UInt32 history) const {
+	vector<Sample> samples;
+	out += '[';
+	lock_guard<mutex> lock(_mutex);
+	bool first = true;
+	for (const shared<Series>& pSeries : _series) {
+		samples.clear();
+		pSeries->read(samples, history);
+		String::Append(out, first ? "" : ",", "{\"id\":", pSeries->id, ",\"name\":\"", Escape(pSeries->name), "\",\"type\":\"", pSeries->type, "\",\"samples\":[");
+		first = false;
+		for (UInt32 i = 0; i < samples.size(); ++i) {
+			const Sample& sample = samples[i];
+			String::Append(out, i ? "," : "", "{\"time\":", sample.time, ",\"rtt\":", sample.rtt, ",\"sendRate\":", sample.sendRate, ",\"recvRate\":", sample.recvRate,
+				",\"sent\":", sample.sent, ",\"received\":", sample.received, ",\"sendLoss\":", sample.sendLoss, ",\"recvLoss\":", sample.recvLoss,
+				",\"sendLossRate\":", sample.sendLossRate, ",\"recvLossRate\":", sample.recvLossRate, ",\"retransmitted\":", sample.retransmitted, ",\"sendDrop\":", sample.sendDrop, ",\"recvDrop\":", sample.recvDrop,
+				",\"sendBuffer\":", sample.sendBuffer, ",\"recvBuffer\":", sample.recvBuffer, ",\"dropped\":", sample.dropped, ",\"pacing\":", sample.pacing);
+			if (pSeries->delivery.count())
+				String::Append(out, ",\"delivery\":", sample.delivery, ",\"deliveryJitter\":", sample.deliveryJitter);
+			const TSInspector::Health& ts = sample.ts;
+			if (ts.packets)
+				String::Append(out, ",\"ts\":{\"packets\":", ts.packets, ",\"syncLoss\":", ts.syncLoss, ",\"syncErrors\":", ts.syncErrors, ",\"patErrors\":", ts.patErrors,
+					",\"continuityErrors\":", ts.continuityErrors, ",\"pmtErrors\":", ts.pmtErrors, ",\"pidErrors\":", ts.pidErrors, ",\"transportErrors\":", ts.transportErrors,
+					",\"crcErrors\":", ts.crcErrors, ",\"pcrRepetitionErrors\":", ts.pcrRepetitionErrors, ",\"pcrDiscontinuityErrors\":", ts.pcrDiscontinuityErrors,
+					",\"pcrJitter\":", ts.pcrJitter, "}");
+			out += '}';
+		}
+		out += "]}";
+	}
+	out += ']';
+	return out;
+}
+
+string& SRTStats::writePrometheus(string& out) const {
+	struct Metric {
+		const char* name;
+		const char* type;
+		const char* help;
+		function<double(const Sample&)> value;
+		bool ts; // TS analysis, only for the series receiving TS
+	};
+	static const Metric Metrics[] = {
+		{ "srt_rtt_ms", "gauge", "Round trip time", [](const Sample& sample) { return sample.rtt; } },
+		{ "srt_send_rate_mbps", "gauge", "Sending rate over the last period", [](const Sample& sample) { return sample.sendRate; } },
+		{ "srt_recv_rate_mbps", "gauge", "Receiving rate over the last period", [](const Sample& sample) { return sample.recvRate; } },
+		{ "srt_sent_packets_total", "counter", "Packets sent", [](const Sample& sample) { return double(sample.sent); } },
+		{ "srt_received_packets_total", "counter", "Packets received", [](const Sample& sample) { return double(sample.received); } },
+		{ "srt_send_loss_packets_total", "counter", "Packets lost on sending", [](const Sample& sample) { return double(sample.sendLoss); } },
+		{ "srt_recv_loss_packets_total", "counter", "Packets lost on reception", [](const Sample& sample) { return double(sample.recvLoss); } },
+		{ "srt_send_loss_percent", "gauge", "Packets lost on sending over the last period", [](const Sample& sample) { return sample.sendLossRate; } },
+		{ "srt_recv_loss_percent", "gauge", "Packets lost on reception over the last period", [](const Sample& sample) { return sample.recvLossRate; } },
+		{ "srt_retransmitted_packets_total", "counter", "Packets retransmitted", [](const Sample& sample) { return double(sample.retransmitted); } },
+		{ "srt_send_drop_packets_total", "counter", "Packets dropped by the sender (too late)", [](const Sample& sample) { return double(sample.sendDrop); } },
+		{ "srt_recv_drop_packets_total", "counter", "Packets dropped by the receiver (too late)", [](const Sample& sample) { return double(sample.recvDrop); } },
+		{ "srt_send_buffer_ms", "gauge", "Data in the sending buffer", [](const Sample& sample) { return double(sample.sendBuffer); } },
+		{ "srt_recv_buffer_ms", "gauge", "Data in the receiving buffer", [](const Sample& sample) { return double(sample.recvBuffer); } },
+		{ "srt_dropped_payloads_total", "counter", "Payloads dropped before SRT (congestion, queue full, disconnected)", [](const Sample& sample) { return double(sample.dropped); } },
+		{ "srt_pacing_delay_ms", "gauge", "Maximum time a payload has been held by the pacer over the last period", [](const Sample& sample) { return sample.pacing; } },
+		{ "srt_delivery_jitter_ms", "gauge", "Smoothed variation of the delivery delay", [](const Sample& sample) { return sample.deliveryJitter; }, true },
+		{ "srt_ts_packets_total", "counter", "TS packets received", [](const Sample& sample) { return double(sample.ts.packets); }, true },
+		{ "srt_ts_sync_loss_total", "counter", "TS resynchronizations (TR 101 290 1.1)", [](const Sample& sample) { return double(sample.ts.syncLoss); }, true },
+		{ "srt_ts_sync_byte_errors_total", "counter", "TS sync byte errors (TR 101 290 1.2)", [](const Sample& sample) { return double(sample.ts.syncErrors); }, true },
+		{ "srt_ts_pat_errors_total", "counter", "PAT missing or invalid (TR 101 290 1.3)", [](const Sample& sample) { return double(sample.ts.patErrors); }, true },
+		{ "srt_ts_continuity_errors_total", "counter", "TS continuity counter errors (TR 101 290 1.4)", [](const Sample& sample) { return double(sample.ts.continuityErrors); }, true },
+		{ "srt_ts_pmt_errors_total", "counter", "PMT missing or invalid (TR 101 290 1.5)", [](const Sample& sample) { return double(sample.ts.pmtErrors); }, true },
+		{ "srt_ts_pid_errors_total", "counter", "PMT PID missing (TR 101 290 1.6)", [](const Sample& sample) { return double(sample.ts.pidErrors); }, true },
+		{ "srt_ts_transport_errors_total", "counter", "TS transport error indicators (TR 101 290 2.1)", [](const Sample& sample) { return double(sample.ts.transportErrors); }, true },
+		{ "srt_ts_crc_errors_total", "counter", "PAT and PMT CRC errors (TR 101 290 2.2)", [](const Sample& sample) { return double(sample.ts.crcErrors); }, true },
+		{ "srt_ts_pcr_repetition_errors_total", "counter", "PCR intervals above 40ms (TR 101 290 2.3a)", [](const Sample& sample) { return double(sample.ts.pcrRepetitionErrors); }, true },
+		{ "srt_ts_pcr_discontinuity_errors_total", "counter", "PCR discontinuities without indicator (TR 101 290 2.3b)", [](const Sample& sample) { return double(sample.ts.pcrDiscontinuityErrors); }, true },
+		{ "srt_ts_pcr_jitter_us", "gauge", "Smoothed PCR jitter against the reception time", [](const Sample& sample) { return double(sample.ts.pcrJitter); }, true }
+	};
+
+	// Last sample of each series
+	vector<pair<shared<Series>, Sample>> lasts;
+	{
+		lock_guard<mutex> lock(_mutex);
+		vector<Sample> samples;
+		for (const shared<Series>& pSeries : _series) {
+			samples.clear();
+			if (pSeries->read(samples, 1) && !samples.empty())
+				lasts.emplace_back(pSeries, samples.back());
+		}
+	}
+
+	for (const Metric& metric : Metrics) {
+		String::Append(out, "# HELP ", metric.name, " ", metric.help, "\n# TYPE ", metric.name, " ", metric.type, "\n");
+		for (auto& it : lasts) {
+			if (metric.ts && !it.second.ts.packets)
+				continue;
+			String::Append(out, metric.name, "{id=\"", it.first->id, "\",name=\"", Escape(it.first->name), "\",type=\"", it.first->type, "\"} ", metric.value(it.second), "\n");
+		}
+	}
+
+	// Delivery delay of the received messages, since the connection
+	static const UInt32 DeliveryBuckets[] = { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 };
+	String::Append(out, "# HELP srt_delivery_delay_ms Reading time of the received messages after their TSBPD delivery time (not the transit over the hop)\n# TYPE srt_delivery_delay_ms histogram\n");
+	for (auto& it : lasts) {
+		const Histogram& delivery = it.first->delivery;
+		if (!delivery.count())
+			continue;
+		string labels(String("id=\"", it.first->id, "\",name=\"", Escape(it.first->name), "\",type=\"", it.first->type, "\""));
+		for (UInt32 bucket : DeliveryBuckets)
+			String::Append(out, "srt_delivery_delay_ms_bucket{", labels, ",le=\"", bucket, "\"} ", delivery.count(bucket * 1000ull), "\n");
+		String::Append(out, "srt_delivery_delay_ms_bucket{", labels, ",le=\"+Inf\"} ", delivery.count(), "\n",
+			"srt_delivery_delay_ms_sum{", labels, "} ", delivery.sum() / 1000.0, "\n", "srt_delivery_delay_ms_count{", labels, "} ", delivery.count(), "\n");
+	}
+
+	// libsrt logs, process-wide
+	String::Append(out, "# HELP srt_log_dropped_total libsrt log messages dropped\n# TYPE srt_log_dropped_total counter\n",
+		"srt_log_dropped_total{reason=\"overflow\"} ", SRTLog::Overflows(), "\n",
+		"srt_log_dropped_total{reason=\"rate\"} ", SRTLog::RateDrops(), "\n",
+		"srt_log_dropped_total{reason=\"duplicate\"} ", SRTLog::Duplicates(), "\n");
+	return out;
+}
+
+void SRTStats::manage(const string& www) {
+	if (!_export)
+		return;
+	string content;
+	WriteFile(www + "/stats.json", writeJSON(content, _exportHistory));
+	content.clear();
+	WriteFile(www + "/metrics", writePrometheus(content));
+}
+
+string SRTStats::Escape(const string& value) {
+	// Same escaping for JSON strings and Prometheus label values
+	string escaped;
+	for (char c : value) {
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		if (c == '\n')
+			escaped += "\\n";
+		else if (UInt8(c) >= 0x20)
+			escaped += c;
+	}
+	return escaped;
+}
+
+void SRTStats::WriteFile(const string& path, const string& content) {
+	// Written aside then renamed to never serve a partial file
+	string tmp(path + ".tmp");
+	{
+		ofstream file(tmp, ios::binary | ios::trunc);
+		if (!file.write(content.data(), content.size())) {
+			WARN("SRT stats: can't write ", path)
+			return;
+		}
+	}
+	if (std::rename(tmp.c_str(), path.c_str()) != 0)
+		WARN("SRT stats: can't replace ", path)
+}
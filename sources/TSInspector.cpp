@@ -0,0 +1,335 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "TSInspector.h"
+#if defined(__AVX2__)
+	#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define TS_SSE2
+#endif
+
+using namespace Mona;
+using namespace std;
+
+static const UInt32 TSPacketSize = 188;
+static const UInt32 ScanPackets = 32; // packets by header scan
+// TR 101 290 limits in us
+static const Int64 TableInterval = 500000;
+static const Int64 PIDInterval = 5000000;
+static const Int64 PCRInterval = 40000;
+static const Int64 PCRGap = 100000;
+
+namespace {
+/*!
+Bit masks by packet of the header fields checked for every packet */
+struct Scan {
+	Scan() : syncErrors(0), transportErrors(0), adaptations(0) {}
+	UInt32 syncErrors; // sync byte different of 0x47
+	UInt32 transportErrors; // transport_error_indicator
+	UInt32 adaptations; // adaptation field present
+};
+}
+
+static void ScanHeaders(const UInt8* data, UInt32 count, Scan& scan) {
+	UInt32 i = 0;
+#if (defined(__AVX2__) || defined(TS_SSE2)) && !__BIG_ENDIAN__
+	// Headers read as little-endian words: sync byte in the low byte, transport_error_indicator at bit 15, adaptation_field_control bit 29
+	alignas(32) UInt32 headers[ScanPackets];
+	for (UInt32 j = 0; j < count; ++j)
+		memcpy(headers + j, data + j * TSPacketSize, 4);
+#if defined(__AVX2__)
+	const __m256i mask = _mm256_set1_epi32(0xFF), sync = _mm256_set1_epi32(0x47);
+	for (; (i + 8) <= count; i += 8) {
+		__m256i words = _mm256_load_si256((const __m256i*)(headers + i));
+		scan.syncErrors |= UInt32(~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(words, mask), sync))) & 0xFF) << i;
+		scan.transportErrors |= UInt32(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(words, 16)))) << i;
+		scan.adaptations |= UInt32(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(words, 2)))) << i;
+	}
+#endif
+	const __m128i mask4 = _mm_set1_epi32(0xFF), sync4 = _mm_set1_epi32(0x47);
+	for (; (i + 4) <= count; i += 4) {
+		__m128i words = _mm_load_si128((const __m128i*)(headers + i));
+		scan.syncErrors |= UInt32(~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(words, mask4), sync4))) & 0x0F) << i;
+		scan.transportErrors |= UInt32(_mm_movemask_ps(_mm_castsi128_ps(_mm_slli_epi32(words, 16)))) << i;
+		scan.adaptations |= UInt32(_mm_movemask_ps(_mm_castsi128_ps(_mm_slli_epi32(words, 2)))) << i;
+	}
+#endif
+	// scalar fallback and remaining packets
+	for (; i < count; ++i) {
+		const UInt8* packet = data + i * TSPacketSize;
+		if (packet[0] != 0x47)
+			scan.syncErrors |= 1 << i;
+		if (packet[1] & 0x80)
+			scan.transportErrors |= 1 << i;
+		if (packet[3] & 0x20)
+			scan.adaptations |= 1 << i;
+	}
+}
+
+// Next position where two sync bytes are 188 bytes apart (or one at the end of the data), NULL if not found
+static const UInt8* FindSync(const UInt8* cur, const UInt8* end) {
+	while ((end - cur) >= Int64(TSPacketSize)) {
+#if defined(__AVX2__) || defined(TS_SSE2)
+		// 16 bytes compared at once
+		const __m128i sync = _mm_set1_epi8(0x47);
+		while ((end - cur) >= 16) {
+			int found = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)cur), sync));
+			if (found) {
+				while (!(found & 1)) {
+					found >>= 1;
+					++cur;
+				}
+				break;
+			}
+			cur += 16;
+		}
+#endif
+		cur = (const UInt8*)memchr(cur, 0x47, end - cur);
+		if (!cur || (end - cur) < Int64(TSPacketSize))
+			return NULL;
+		if ((end - cur) < Int64(2 * TSPacketSize) || cur[TSPacketSize] == 0x47)
+			return cur;
+		++cur;
+	}
+	return NULL;
+}
+
+// CRC-32/MPEG-2 of the PSI sections
+static UInt32 CRC32(const UInt8* data, UInt32 size) {
+	static const struct Table {
+		Table() {
+			for (UInt32 i = 0; i < 256; ++i) {
+				UInt32 crc = i << 24;
+				for (UInt8 bit = 0; bit < 8; ++bit)
+					crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+				values[i] = crc;
+			}
+		}
+		UInt32 values[256];
+	} Table;
+	UInt32 crc = 0xFFFFFFFF;
+	while (size--)
+		crc = (crc << 8) ^ Table.values[((crc >> 24) ^ *data++) & 0xFF];
+	return crc;
+}
+
+TSInspector::TSInspector() : _pmtPID(0), _pcrPID(0x1FFF), _patTime(0), _pmtTime(0), _pidTime(0), _pcr(-1), _pcrTime(0) {
+	memset(_kinds, KIND_UNKNOWN, sizeof(_kinds));
+	memset(_counters, 0xFF, sizeof(_counters));
+	_kinds[0] = KIND_PSI;
+}
+
+UInt8 TSInspector::inspect(const UInt8* data, UInt32 size) {
+	Int64 now = Now();
+	if (!_patTime)
+		_patTime = _pmtTime = _pidTime = now; // tables expected from the first message
+	UInt8 flags = 0;
+	const UInt8* end = data + size;
+	while ((end - data) >= Int64(TSPacketSize)) {
+		Scan scan;
+		UInt32 count = min<UInt32>(ScanPackets, UInt32((end - data) / TSPacketSize));
+		ScanHeaders(data, count, scan);
+		UInt32 i = 0;
+		for (; i < count; ++i) {
+			const UInt8* packet = data + i * TSPacketSize;
+			UInt32 bit = 1 << i;
+			++_health.packets;
+			if (scan.syncErrors & bit) {
+				++_health.syncErrors;
+				break;
+			}
+			if (scan.transportErrors & bit) {
+				++_health.transportErrors;
+				continue; // header not reliable
+			}
+			flags |= inspect(packet, (scan.adaptations & bit) != 0, now);
+		}
+		if (i == count) {
+			data += count * TSPacketSize;
+			continue;
+		}
+		// Sync byte error: resynchronize on the next pair of sync bytes
+		++_health.syncLoss;
+		data = FindSync(data + i * TSPacketSize + 1, end);
+		if (!data)
+			break;
+	}
+	return flags;
+}
+
+UInt8 TSInspector::inspect(const UInt8* packet, bool adaptation, Int64 now) {
+	UInt16 pid = ((packet[1] & 0x1F) << 8) | packet[2];
+	if (pid == 0x1FFF)
+		return 0; // null packet
+	bool discontinuity = false, randomAccess = false;
+	const UInt8* payload = packet + 4;
+	if (adaptation) {
+		UInt8 length = packet[4];
+		if (length) {
+			discontinuity = (packet[5] & 0x80) != 0;
+			randomAccess = (packet[5] & 0x40) != 0;
+			if (pid == _pcrPID && length >= 7 && (packet[5] & 0x10))
+				readPCR(packet, now);
+		}
+		payload += 1 + length;
+	}
+
+	// Continuity counter incremented only by the packets with payload, one duplicate allowed
+	if (packet[3] & 0x10) {
+		UInt8 counter = packet[3] & 0x0F;
+		UInt8 last = _counters[pid];
+		if (last != 0xFF && !discontinuity && counter != ((last + 1) & 0x0F) && counter != last)
+			++_health.continuityErrors;
+		_counters[pid] = counter;
+	}
+
+	UInt8 kind = _kinds[pid];
+	_kinds[pid] |= KIND_SEEN;
+	switch (kind & ~KIND_SEEN) {
+		case KIND_PSI:
+			if ((packet[1] & 0x40) && payload < (packet + TSPacketSize)) {
+				if (pid)
+					readPMT(payload, UInt32(packet + TSPacketSize - payload), now);
+				else
+					readPAT(payload, UInt32(packet + TSPacketSize - payload), now);
+			}
+			return TSPacker::FLAG_PSI;
+		case KIND_AUDIO:
+			return TSPacker::FLAG_AUDIO;
+		default:
+			// Unknown PID are considered as video until the PMT is read
+			return randomAccess ? (TSPacker::FLAG_VIDEO | TSPacker::FLAG_KEY) : TSPacker::FLAG_VIDEO;
+	}
+}
+
+void TSInspector::check() {
+	Int64 now = Now();
+	if (!_patTime)
+		return; // nothing received yet
+	// Tables missing, counted once by interval
+	if ((now - _patTime) > TableInterval) {
+		++_health.patErrors;
+		_patTime = now;
+	}
+	if (_pmtPID && (now - _pmtTime) > TableInterval) {
+		++_health.pmtErrors;
+		_pmtTime = now;
+	}
+	if ((now - _pidTime) < PIDInterval)
+		return;
+	_pidTime = now;
+	for (UInt16 pid : _esPIDs) {
+		if (!(_kinds[pid] & KIND_SEEN))
+			++_health.pidErrors;
+		_kinds[pid] &= ~KIND_SEEN;
+	}
+}
+
+const UInt8* TSInspector::readSection(const UInt8* payload, UInt32 size, UInt8 tableId, UInt32& length) {
+	// pointer field, then table_id(1) section_length(2)
+	UInt32 pos = 1 + payload[0];
+	if (pos + 3 > size || payload[pos] != tableId)
+		return NULL;
+	length = 3 + (((payload[pos + 1] & 0x0F) << 8) | payload[pos + 2]);
+	if (length < 12 || pos + length > size)
+		return NULL; // sections on several packets are not checked
+	if (CRC32(payload + pos, length)) {
+		++_health.crcErrors;
+		return NULL;
+	}
+	length -= 4; // without CRC
+	return payload + pos;
+}
+
+void TSInspector::readPAT(const UInt8* data, UInt32 size, Int64 now) {
+	UInt32 length;
+	const UInt8* section = readSection(data, size, 0x00, length);
+	if (!section) {
+		++_health.patErrors;
+		return;
+	}
+	if ((now - _patTime) > TableInterval)
+		++_health.patErrors;
+	_patTime = now;
+	// transport_stream_id(2) version(1) section numbers(2), then program_number(2) PID(2), the first program is kept
+	for (UInt32 pos = 8; pos + 4 <= length; pos += 4) {
+		if (!((section[pos] << 8) | section[pos + 1]))
+			continue; // network PID
+		UInt16 pid = ((section[pos + 2] & 0x1F) << 8) | section[pos + 3];
+		if (pid == _pmtPID)
+			return;
+		if (_pmtPID)
+			_kinds[_pmtPID] = KIND_UNKNOWN;
+		_pmtPID = pid;
+		_pmtTime = now;
+		_kinds[pid] = KIND_PSI;
+		return;
+	}
+}
+
+void TSInspector::readPMT(const UInt8* data, UInt32 size, Int64 now) {
+	UInt32 length;
+	const UInt8* section = readSection(data, size, 0x02, length);
+	if (!section) {
+		++_health.pmtErrors;
+		return;
+	}
+	if ((now - _pmtTime) > TableInterval)
+		++_health.pmtErrors;
+	_pmtTime = now;
+	// program_number(2) version(1) section numbers(2) PCR_PID(2) program_info_length(2)
+	_pcrPID = ((section[8] & 0x1F) << 8) | section[9];
+	_esPIDs.clear();
+	// stream_type(1) PID(2) ES_info_length(2) descriptors
+	for (UInt32 pos = 12 + (((section[10] & 0x0F) << 8) | section[11]); pos + 5 <= length; pos += 5 + (((section[pos + 3] & 0x0F) << 8) | section[pos + 4])) {
+		UInt16 pid = ((section[pos + 1] & 0x1F) << 8) | section[pos + 2];
+		_esPIDs.emplace_back(pid);
+		switch (section[pos]) {
+			case 0x03: // MPEG-1 audio
+			case 0x04: // MPEG-2 audio
+			case 0x0F: // AAC ADTS
+			case 0x11: // AAC LATM
+			case 0x81: // AC-3
+				_kinds[pid] = (_kinds[pid] & KIND_SEEN) | KIND_AUDIO;
+				break;
+			default:
+				_kinds[pid] = (_kinds[pid] & KIND_SEEN) | KIND_VIDEO;
+		}
+	}
+}
+
+void TSInspector::readPCR(const UInt8* packet, Int64 now) {
+	// program_clock_reference_base(33) reserved(6) extension(9), in 90kHz for the base
+	UInt64 base = (UInt64(packet[6]) << 25) | (packet[7] << 17) | (packet[8] << 9) | (packet[9] << 1) | (packet[10] >> 7);
+	Int64 pcr = Int64(base * 100 / 9);
+	Int64 last = _pcr, lastTime = _pcrTime;
+	_pcr = pcr;
+	_pcrTime = now;
+	if (last < 0 || (packet[5] & 0x80))
+		return; // first PCR or discontinuity_indicator
+	Int64 delta = pcr - last;
+	if (delta < 0 || delta > PCRGap) {
+		++_health.pcrDiscontinuityErrors;
+		return;
+	}
+	if (delta > PCRInterval)
+		++_health.pcrRepetitionErrors;
+	// Jitter smoothed as RFC 3550 does
+	Int64 jitter = delta - (now - lastTime);
+	if (jitter < 0)
+		jitter = -jitter;
+	_health.pcrJitter += Int32(jitter - _health.pcrJitter) / 16;
+}
@@ -0,0 +1,384 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "TSMux.h"
+#include "Mona/AVC.h"
+#include "Mona/Logs.h"
+#include "Mona/Time.h"
+#include "SRTRuntime.h"
+
+using namespace Mona;
+using namespace std;
+
+static const UInt32 TSPacketSize = 188;
+
+// Timestamps field of the PES header starting in a TS packet, NULL if there is no PES header with timestamps
+static UInt8* PESTimestamps(UInt8* packet, UInt8& flags) {
+	if (packet[0] != 0x47 || !(packet[1] & 0x40))
+		return NULL;
+	UInt32 pos = 4;
+	if (packet[3] & 0x20)
+		pos += 1 + packet[4]; // adaptation field
+	if (pos + 14 > TSPacketSize || packet[pos] || packet[pos + 1] || packet[pos + 2] != 1)
+		return NULL;
+	flags = packet[pos + 7] >> 6; // PTS_DTS_flags
+	return (flags & 2) ? (packet + pos + 9) : NULL;
+}
+
+TSMux::TSMux(ThreadPool& threadPool, UInt32 holdDelay, UInt32 queueSize, UInt32 gopCache, UInt32 configInterval, UInt32 sourceDrift) : holdDelay(holdDelay), gopCache(gopCache), configInterval(configInterval), sourceDrift(sourceDrift),
+	_threadPool(threadPool), _track(0), _frames(queueSize), _scheduled(false), _dropped(0),
+	_capturing(false), _splicing(false), _caching(false), _configTime(0), _videoCodecSent(false), _audioCodecSent(false), _first(true), _gopStart(false), _gopSize(-1), _srcOrigin(0) {
+	_tsPacker.onPayload = [this](const TSPacker::Payload& payload) {
+		onPayload(payload);
+		cache(payload);
+	};
+}
+
+bool TSMux::writeAudio(UInt16 track, const Media::Audio::Tag& tag, const Packet& packet) {
+	return push(Frame(track, tag, packet));
+}
+
+bool TSMux::writeVideo(UInt16 track, const Media::Video::Tag& tag, const Packet& packet) {
+	return push(Frame(track, tag, packet));
+}
+
+void TSMux::flush() {
+	push(Frame(Frame::TYPE_FLUSH));
+}
+
+void TSMux::reset() {
+	push(Frame(Frame::TYPE_RESET));
+}
+
+bool TSMux::push(Frame&& frame) {
+	if (!_frames.push(move(frame))) {
+		if (!_dropped++)
+			WARN("TSMux queue full, frames dropped")
+		return false;
+	}
+	if (_dropped) {
+		WARN(_dropped, " frames dropped by TSMux")
+		_dropped = 0;
+	}
+	// Schedule the muxing on the worker thread if not already scheduled
+	if (!_scheduled.exchange(true))
+		_threadPool.queue(make_shared<Muxing>(shared_from_this()), _track);
+	return true;
+}
+
+void TSMux::process() {
+	// Reset the flag before reading to never miss a frame pushed meanwhile
+	_scheduled = false;
+	Frame frame;
+	while (_frames.pop(frame)) {
+		switch (frame.type) {
+			case Frame::TYPE_AUDIO:
+				LATENCY_RECORD(STAGE_MUX_QUEUE, frame.stamp);
+				LATENCY_STAMP(frame.stamp);
+				writeAudio(frame.audio, frame.packet);
+				LATENCY_RECORD(STAGE_MUX, frame.stamp);
+				break;
+			case Frame::TYPE_VIDEO:
+				LATENCY_RECORD(STAGE_MUX_QUEUE, frame.stamp);
+				LATENCY_STAMP(frame.stamp);
+				writeVideo(frame.video, frame.packet);
+				LATENCY_RECORD(STAGE_MUX, frame.stamp);
+				break;
+			case Frame::TYPE_RESET:
+				_tsPacker.flush();
+				if (_tsPacker.payloads())
+					INFO(_tsPacker.payloads(), " SRT payloads sent, fill ratio ", UInt32(_tsPacker.fillRatio() * 100), "%")
+				_tsWriter.endMedia([](const Packet& packet) {}); // reset the ts writer
+				_videoCodec.reset();
+				_audioCodec.reset();
+				_videoCodecSent = _audioCodecSent = false;
+				resetConfig();
+				_first = true;
+				_gop.clear();
+				_gopSize = -1;
+				_srcOrigin = 0;
+				break;
+			default:
+				holdPayload();
+				break;
+		}
+	}
+}
+
+void TSMux::writeAudio(const Media::Audio::Tag& tag, const Packet& packet) {
+
+	// AAC codecs to be sent in first
+	if (!_audioCodecSent) {
+		if (tag.codec == Media::Audio::CODEC_AAC && tag.isConfig) {
+
+			INFO("AAC codec infos saved")
+			_audioCodec.set(std::move(packet));
+		}
+		if (!_audioCodec)
+			return;
+
+		_audioCodecSent = true;
+		INFO("AAC codec infos sent")
+		Media::Audio::Tag configTag(tag);
+		configTag.isConfig = true;
+		configTag.time = tag.time;
+		if (!tag.isConfig)
+			writeFrame(configTag, _audioCodec);
+	}
+
+	writeFrame(tag, packet);
+}
+
+void TSMux::writeVideo(const Media::Video::Tag& tag, const Packet& packet) {
+
+	// Video codecs to be sent in first
+	if (!_videoCodecSent) {
+
+		Packet sps, pps;
+		bool isAVCConfig(tag.codec == Media::Video::CODEC_H264 && tag.frame == Media::Video::FRAME_CONFIG && AVC::ParseVideoConfig(packet, sps, pps));
+		if (isAVCConfig) {
+			INFO("Video codec infos saved")
+			_videoCodec.set(std::move(packet));
+		}
+		if (!_videoCodec)
+			return;
+
+		if (tag.frame != Media::Video::FRAME_KEY) {
+			DEBUG("Video frame dropped to wait first key frame")
+			return;
+		}
+
+		_videoCodecSent = true;
+		INFO("Video codec infos sent")
+		beginGOP();
+		if (!isAVCConfig)
+			writeConfig(tag);
+	}
+	// Send Regularly the codec infos
+	else if (tag.codec == Media::Video::CODEC_H264 && tag.frame == Media::Video::FRAME_KEY) {
+		beginGOP();
+		writeConfig(tag);
+	}
+	// Codec change, muxed as received and cached again on the next keyframe
+	else if (tag.codec == Media::Video::CODEC_H264 && tag.frame == Media::Video::FRAME_CONFIG) {
+		INFO("Video codec infos changed")
+		_videoCodec.set(std::move(packet));
+		resetConfig();
+	}
+
+	writeFrame(tag, packet);
+}
+
+void TSMux::writeFrame(const Media::Video::Tag& tag, const Packet& packet) {
+	beginMedia();
+	UInt8 flags = IsDisposable(tag, packet) ? TSPacker::FLAG_DISPOSABLE : TSPacker::FLAG_VIDEO;
+	if (_gopStart) {
+		flags |= TSPacker::FLAG_KEY;
+		_gopStart = false;
+	}
+	Int64 srcTime(sourceTime(tag.time));
+	_tsWriter.writeVideo(0, tag, packet, [this, flags, srcTime](const Packet& output) {
+		if (_splicing) {
+			_splicing = false;
+			spliceConfig(output);
+		} else if (_caching) {
+			_caching = false;
+			cacheConfig(output);
+		}
+		if (_capturing)
+			_configTS.append(output.data(), output.size());
+		_tsPacker.write(output, flags, srcTime);
+	});
+	holdPayload();
+}
+
+void TSMux::writeConfig(const Media::Video::Tag& tag) {
+	Int64 now = Time::Now();
+	if (configInterval && _configTime && (now - _configTime) < configInterval) {
+		// Not sent on this keyframe, the GOP cache still starts with the codec infos
+		_caching = _configTS.size() > 0; // before the first TS packet of the keyframe
+		return;
+	}
+	_configTime = now;
+	if (_configTS.size()) {
+		DEBUG("Splicing codec infos")
+		_splicing = true; // before the first TS packet of the keyframe
+		return;
+	}
+
+	DEBUG("Sending codec infos")
+	Media::Video::Tag configTag(tag);
+	configTag.frame = Media::Video::FRAME_CONFIG;
+	configTag.time = tag.time;
+	_capturing = true;
+	writeFrame(configTag, _videoCodec);
+	_capturing = false;
+	if (!_configTS.size())
+		return; // nothing muxed apart, no cache
+
+	// Program tables first, then the PCR are removed: a spliced copy must not move the clock back
+	Buffer config;
+	config.append(_psiTS.data(), _psiTS.size());
+	config.append(_configTS.data(), _configTS.size());
+	_configTS.clear();
+	_configTS.append(config.data(), config.size());
+	for (UInt32 pos = 0; (pos + TSPacketSize) <= _configTS.size(); pos += TSPacketSize) {
+		UInt8* packet = _configTS.data() + pos;
+		// adaptation field with only the PCR as optional field
+		if ((packet[3] & 0x20) && packet[4] >= 7 && (packet[5] & 0x1F) == 0x10) {
+			packet[5] &= ~0x10;
+			memset(packet + 6, 0xFF, 6); // stuffing
+		}
+	}
+}
+
+void TSMux::spliceConfig(const Packet& keyframe) {
+	timeConfig(keyframe);
+	// TSPacker patches the continuity counters
+	_tsPacker.write(Packet(_configTS.data(), _configTS.size()), TSPacker::FLAG_PSI | TSPacker::FLAG_VIDEO | TSPacker::FLAG_KEY);
+}
+
+void TSMux::cacheConfig(const Packet& keyframe) {
+	timeConfig(keyframe);
+	shared<Buffer> pBuffer(new Buffer());
+	pBuffer->append(_configTS.data(), _configTS.size());
+
+	// Continuity counters ending on the current ones of TSPacker, the live TS packets continue the copy without discontinuity
+	map<UInt16, UInt8> remaining;
+	for (UInt32 pos = 0; (pos + TSPacketSize) <= pBuffer->size(); pos += TSPacketSize) {
+		const UInt8* packet = pBuffer->data() + pos;
+		UInt16 pid = ((packet[1] & 0x1F) << 8) | packet[2];
+		if (packet[0] == 0x47 && (packet[3] & 0x10) && pid != 0x1FFF)
+			++remaining[pid];
+	}
+	for (UInt32 pos = 0; (pos + TSPacketSize) <= pBuffer->size(); pos += TSPacketSize) {
+		UInt8* packet = pBuffer->data() + pos;
+		UInt16 pid = ((packet[1] & 0x1F) << 8) | packet[2];
+		if (packet[0] == 0x47 && (packet[3] & 0x10) && pid != 0x1FFF)
+			packet[3] = (packet[3] & 0xF0) | ((_tsPacker.counter(pid) - --remaining[pid]) & 0x0F);
+	}
+
+	// Cached only, the outputs already connected don't receive it
+	Packet config(pBuffer);
+	UInt8 flags = TSPacker::FLAG_PSI | TSPacker::FLAG_VIDEO | TSPacker::FLAG_KEY;
+	for (UInt32 pos = 0; pos < config.size(); pos += TSPacker::PAYLOAD_SIZE) {
+		cache(TSPacker::Payload(Packet(config, config.data() + pos, min(config.size() - pos, TSPacker::PAYLOAD_SIZE)), flags));
+		flags &= ~TSPacker::FLAG_KEY;
+	}
+}
+
+void TSMux::timeConfig(const Packet& keyframe) {
+	// The codec infos take the timestamps of the keyframe, DTS or PTS for the decoding time
+	UInt8 keyFlags(0), configFlags(0);
+	const UInt8* key = keyframe.size() >= TSPacketSize ? PESTimestamps((UInt8*)keyframe.data(), keyFlags) : NULL;
+	if (key) {
+		UInt16 pid = ((keyframe.data()[1] & 0x1F) << 8) | keyframe.data()[2];
+		for (UInt32 pos = 0; (pos + TSPacketSize) <= _configTS.size(); pos += TSPacketSize) {
+			UInt8* packet = _configTS.data() + pos;
+			UInt8* config = (((packet[1] & 0x1F) << 8) | packet[2]) == pid ? PESTimestamps(packet, configFlags) : NULL;
+			if (!config)
+				continue;
+			config[0] = (config[0] & 0xF0) | (key[0] & 0x0F);
+			memcpy(config + 1, key + 1, 4);
+			if (configFlags == 3) {
+				const UInt8* decoding = keyFlags == 3 ? key + 5 : key;
+				config[5] = (config[5] & 0xF0) | (decoding[0] & 0x0F);
+				memcpy(config + 6, decoding + 1, 4);
+			}
+			break;
+		}
+	}
+}
+
+void TSMux::resetConfig() {
+	_configTS.clear();
+	_configTime = 0;
+	_splicing = _caching = false;
+}
+
+void TSMux::writeFrame(const Media::Audio::Tag& tag, const Packet& packet) {
+	beginMedia();
+	Int64 srcTime(sourceTime(tag.time));
+	_tsWriter.writeAudio(0, tag, packet, [this, srcTime](const Packet& output) { _tsPacker.write(output, TSPacker::FLAG_AUDIO, srcTime); });
+	holdPayload();
+}
+
+Int64 TSMux::sourceTime(UInt32 time) {
+	// A frame received earlier than its media time (or later than sourceDrift) moves the anchor,
+	// so the source times are never in the future nor late enough for the receiver to drop them
+	Int64 now = ::srt_time_now();
+	Int64 srcTime = _srcOrigin + Int64(time) * 1000;
+	if (!_srcOrigin || srcTime > now || (now - srcTime) > Int64(sourceDrift) * 1000) {
+		_srcOrigin = now - Int64(time) * 1000;
+		return now;
+	}
+	return srcTime;
+}
+
+bool TSMux::IsDisposable(const Media::Video::Tag& tag, const Packet& packet) {
+	if (tag.frame == Media::Video::FRAME_DISPOSABLE_INTER)
+		return true;
+	if (tag.codec != Media::Video::CODEC_H264 || tag.frame != Media::Video::FRAME_INTER || packet.size() < 5)
+		return false;
+	// H264 frame without any reference NAL unit (nal_ref_idc = 0), NAL units are prefixed by their 4 bytes size
+	const UInt8* cur = packet.data();
+	const UInt8* end = cur + packet.size();
+	while ((end - cur) > 4) {
+		UInt32 size = (cur[0] << 24) | (cur[1] << 16) | (cur[2] << 8) | cur[3];
+		cur += 4;
+		if (!size || size > UInt32(end - cur))
+			return false;
+		if (*cur & 0x60)
+			return false;
+		cur += size;
+	}
+	return true;
+}
+
+void TSMux::beginMedia() {
+	if (!_first)
+		return;
+	_psiTS.clear();
+	_tsWriter.beginMedia([this](const Packet& output) {
+		_psiTS.append(output.data(), output.size());
+		_tsPacker.write(output, TSPacker::FLAG_PSI);
+	});
+	_first = false;
+}
+
+void TSMux::holdPayload() {
+	Int64 time = _tsPacker.time();
+	if (time && (Time::Now() - time) >= holdDelay)
+		_tsPacker.flush();
+}
+
+void TSMux::beginGOP() {
+	_tsPacker.flush(); // end of the previous GOP
+	_gopStart = true;
+	_gop.clear();
+	_gopSize = gopCache ? 0 : -1;
+}
+
+void TSMux::cache(const TSPacker::Payload& payload) {
+	if (_gopSize == UInt32(-1))
+		return;
+	if ((_gopSize += payload.size()) > gopCache) {
+		DEBUG("GOP cache overflow (", gopCache, " bytes), disabled until the next keyframe")
+		_gop.clear();
+		_gopSize = -1;
+		return;
+	}
+	_gop.emplace_back(payload); // shared buffer, no copy
+}
@@ -0,0 +1,75 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "TSPacker.h"
+#include "Mona/Time.h"
+
+using namespace Mona;
+using namespace std;
+
+static const UInt32 TSPacketSize = 188;
+
+const UInt32 TSPacker::PAYLOAD_SIZE;
+
+TSPacker::TSPacker(UInt32 maxPayloads) : _pool(PAYLOAD_SIZE, maxPayloads), _time(0), _flags(0), _srcTime(0), _payloads(0), _bytes(0) {
+	memset(_counters, 0x0F, sizeof(_counters));
+}
+
+void TSPacker::write(const Packet& packet, UInt8 flags, Int64 srcTime) {
+	const UInt8* data = packet.data();
+	UInt32 size = packet.size();
+	while (size) {
+		if (!_pBuffer)
+			_pBuffer = _pool.acquire();
+		if (!_pBuffer->size()) {
+			_time = Time::Now();
+			LATENCY_STAMP(_stamp);
+		}
+		_flags |= flags;
+		if (!_srcTime)
+			_srcTime = srcTime;
+		UInt32 start = _pBuffer->size();
+		UInt32 copied = min(size, PAYLOAD_SIZE - start);
+		_pBuffer->append(data, copied);
+		// Continuity counter of the packets with payload, payloads are aligned on TS packets
+		for (UInt32 pos = (start + TSPacketSize - 1) / TSPacketSize * TSPacketSize; (pos + 4) <= _pBuffer->size(); pos += TSPacketSize) {
+			UInt8* packet = _pBuffer->data() + pos;
+			UInt16 pid = ((packet[1] & 0x1F) << 8) | packet[2];
+			if (packet[0] != 0x47 || !(packet[3] & 0x10) || pid == 0x1FFF)
+				continue;
+			packet[3] = (packet[3] & 0xF0) | (_counters[pid] = (_counters[pid] + 1) & 0x0F);
+		}
+		data += copied;
+		size -= copied;
+		if (_pBuffer->size() == PAYLOAD_SIZE) {
+			flush();
+			flags &= ~FLAG_KEY;
+		}
+	}
+}
+
+void TSPacker::flush() {
+	if (!_pBuffer || !_pBuffer->size())
+		return;
+	++_payloads;
+	_bytes += _pBuffer->size();
+	shared<Buffer> pBuffer(move(_pBuffer));
+	UInt8 flags(_flags);
+	_flags = 0;
+	Int64 srcTime(_srcTime);
+	_srcTime = 0;
+	LATENCY_RECORD(STAGE_PAYLOAD, _stamp);
+	onPayload(Payload(Packet(pBuffer), flags, srcTime));
+}
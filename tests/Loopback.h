@@ -0,0 +1,62 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "SRTRuntime.h"
+
+/*!
+Pair of SRT sockets connected on the loopback in live mode, with the default latency */
+struct Loopback : virtual Mona::Object {
+	Loopback() : caller(::SRT_INVALID_SOCK), receiver(::SRT_INVALID_SOCK), _listener(::SRT_INVALID_SOCK) {
+		::srt_startup();
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int size = sizeof(address);
+		_listener = ::srt_create_socket();
+		if (::srt_bind(_listener, (sockaddr*)&address, sizeof(address)) != 0 || ::srt_listen(_listener, 1) != 0 || ::srt_getsockname(_listener, (sockaddr*)&address, &size) != 0)
+			return;
+		caller = ::srt_create_socket();
+		if (::srt_connect(caller, (sockaddr*)&address, sizeof(address)) != 0)
+			return;
+		receiver = ::srt_accept(_listener, NULL, NULL);
+		int timeout = 1000;
+		::srt_setsockflag(receiver, SRTO_RCVTIMEO, &timeout, sizeof(timeout));
+	}
+	~Loopback() {
+		::srt_close(receiver);
+		::srt_close(caller);
+		::srt_close(_listener);
+		::srt_cleanup();
+	}
+
+	bool connected() const { return receiver != ::SRT_INVALID_SOCK; }
+	// Read count messages at most, return the number of messages received before a timeout of 1s
+	Mona::UInt32 receive(Mona::UInt32 count) {
+		char buffer[1500];
+		Mona::UInt32 received = 0;
+		while (received < count && ::srt_recvmsg(receiver, buffer, sizeof(buffer)) > 0)
+			++received;
+		return received;
+	}
+
+	::SRTSOCKET	caller;
+	::SRTSOCKET	receiver;
+
+private:
+	::SRTSOCKET	_listener;
+};
@@ -0,0 +1,42 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "Test.h"
+#include "SRTLog.h"
+
+using namespace Mona;
+using namespace std;
+
+struct SRTLogTest {
+	// Message logged by libsrt
+	static void Log(SRTLog& log, const char* message) { SRTLog::Callback(&log, 5, __FILE__, __LINE__, "SRT.c", message); }
+};
+
+TEST(LogRepeatedMessageDeduplicated) {
+	Parameters configs;
+	configs.setString("srt.logRate", "0");
+	SRTLog log(configs);
+	CHECK(log.start());
+	UInt64 duplicates = SRTLog::Duplicates();
+
+	// Same libsrt message three times in a row, then an other one
+	for (UInt8 i = 0; i < 3; ++i)
+		SRTLogTest::Log(log, "Connection timed out");
+	SRTLogTest::Log(log, "Connection established");
+	log.stop(); // drains the queue
+
+	CHECK(SRTLog::Duplicates() - duplicates == 2);
+	CHECK(!SRTLog::Overflows());
+}
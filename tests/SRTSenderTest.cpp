@@ -0,0 +1,57 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "Test.h"
+#include "SRTSender.h"
+#include "Loopback.h"
+#include <thread>
+
+using namespace Mona;
+using namespace std;
+
+struct Sender : SRTSender {
+	Sender(const Options& options) : SRTSender(options) {}
+	// Connection of a socket, without cached GOP
+	void connect(::SRTSOCKET socket) {
+		activate(socket);
+		join(deque<TSPacker::Payload>());
+	}
+};
+
+TEST(SourceTimeAfterReconnect) {
+	Parameters configs;
+	configs.setBoolean("srt.sourceTime", true);
+	configs.setString("srt.pacing", "0");
+	Sender sender((SRTSender::Options(configs)));
+	static const UInt8 Data[TSPacker::PAYLOAD_SIZE] = { 0x47 };
+	Int64 time;
+	{
+		Loopback first;
+		CHECK(first.connected());
+		sender.connect(first.caller);
+		time = ::srt_time_now();
+		CHECK(sender.write(TSPacker::Payload(Packet(Data, sizeof(Data)), TSPacker::FLAG_VIDEO, time)));
+		CHECK(first.receive(1) == 1);
+	}
+
+	// Reconnection: a source time older than the new socket is sent with its start time rather than refused by libsrt
+	this_thread::sleep_for(chrono::milliseconds(10));
+	Loopback second;
+	CHECK(second.connected());
+	sender.connect(second.caller);
+	CHECK(sender.write(TSPacker::Payload(Packet(Data, sizeof(Data)), TSPacker::FLAG_VIDEO, time)));
+	CHECK(second.receive(1) == 1);
+	CHECK(!sender.drops().errors);
+}
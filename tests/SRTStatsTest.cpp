@@ -0,0 +1,50 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "Test.h"
+#include "SRTStats.h"
+#include "Mona/String.h"
+#include <cstring>
+
+using namespace Mona;
+using namespace std;
+
+static UInt32 Count(const string& text, const string& pattern) {
+	UInt32 count = 0;
+	for (size_t found = text.find(pattern); found != string::npos; found = text.find(pattern, found + pattern.size()))
+		++count;
+	return count;
+}
+
+TEST(PrometheusSeriesSharingAName) {
+	Parameters configs;
+	configs.setBoolean("srt.statsExport", false);
+	SRTStats stats(configs);
+	shared<SRTStats::Series> pFirst(stats.add("live", "output")), pSecond(stats.add("live", "output"));
+	CHECK(pFirst->id != pSecond->id);
+
+	::SRT_TRACEBSTATS bstats;
+	memset(&bstats, 0, sizeof(bstats));
+	bstats.msTimeStamp = stats.period;
+	pFirst->sample(bstats, stats.period);
+	pSecond->sample(bstats, stats.period);
+
+	// One line by series for every metric, told apart by their id
+	string out;
+	stats.writePrometheus(out);
+	CHECK(Count(out, "srt_rtt_ms{") == 2);
+	CHECK(Count(out, String("srt_rtt_ms{id=\"", pFirst->id, "\",name=\"live\",type=\"output\"} ")) == 1);
+	CHECK(Count(out, String("srt_rtt_ms{id=\"", pSecond->id, "\",name=\"live\",type=\"output\"} ")) == 1);
+}
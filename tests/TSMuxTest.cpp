@@ -0,0 +1,64 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "Test.h"
+#include "TSMux.h"
+#include "SRTSender.h"
+#include "Loopback.h"
+#include <thread>
+
+using namespace Mona;
+using namespace std;
+
+TEST(LaggingSourceNotDropped) {
+	Loopback loopback;
+	CHECK(loopback.connected());
+	::SRTSOCKET caller = loopback.caller;
+
+	// Payloads sent from the muxer with their source time, as SRTSender does
+	Parameters configs;
+	ThreadPool threadPool;
+	shared<TSMux> pMux(new TSMux(threadPool, 0, 1024, 0, 0, SRTSender::Options(configs).sourceDrift()));
+	atomic<UInt32> sent(0);
+	pMux->onPayload = [caller, &sent](const TSPacker::Payload& payload) {
+		::SRT_MSGCTRL control = ::srt_msgctrl_default;
+		control.srctime = payload.time;
+		if (::srt_sendmsg2(caller, (const char*)payload.data(), payload.size(), &control) >= 0)
+			++sent;
+	};
+
+	// Source lagging behind the real time: 40ms of audio every 50ms, 250ms late after 25 frames (default latency 120ms)
+	static const UInt8 Config[] = { 0x12, 0x10 }; // AAC LC 44100Hz stereo
+	static const UInt8 Frame[200] = { 0 };
+	Media::Audio::Tag tag(Media::Audio::CODEC_AAC);
+	tag.rate = 44100;
+	tag.channels = 2;
+	tag.isConfig = true;
+	pMux->writeAudio(0, tag, Packet(Config, sizeof(Config)));
+	tag.isConfig = false;
+	for (UInt32 i = 0; i < 25; ++i) {
+		tag.time = i * 40;
+		pMux->writeAudio(0, tag, Packet(Frame, sizeof(Frame)));
+		pMux->flush();
+		this_thread::sleep_for(chrono::milliseconds(50));
+	}
+	pMux->reset();
+	this_thread::sleep_for(chrono::milliseconds(100));
+
+	CHECK(sent > 0 && loopback.receive(sent) == sent);
+	::SRT_TRACEBSTATS stats;
+	CHECK(::srt_bstats(loopback.receiver, &stats, 0) == 0);
+	CHECK(stats.pktRcvDropTotal == 0);
+}
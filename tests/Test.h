@@ -0,0 +1,33 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include "Mona/Mona.h"
+#include <cstdio>
+
+/*!
+Minimal unit tests without socket nor server (make test): a TEST registers itself, CHECK reports a failure and continues */
+struct Test {
+	typedef void (*Function)();
+
+	Test(const char* name, Function function) { Tests().emplace_back(name, function); }
+
+	static std::vector<std::pair<const char*, Function>>& Tests() { static std::vector<std::pair<const char*, Function>> Tests; return Tests; }
+	static Mona::UInt32& Failures() { static Mona::UInt32 Failures(0); return Failures; }
+};
+
+#define TEST(NAME) static void NAME(); static Test NAME##Test(#NAME, NAME); static void NAME()
+#define CHECK(CONDITION) if (!(CONDITION)) { ++Test::Failures(); fprintf(stderr, "%s:%d CHECK(%s) failed\n", __FILE__, __LINE__, #CONDITION); }
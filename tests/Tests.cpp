@@ -0,0 +1,41 @@
+/*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; If not, see <http://www.gnu.org/licenses/>
+*/
+
+/*
+Unit tests runner, exit code 1 if a check has failed
+
+Usage: MonaSRTTests [name]
+	runs only the test named if given
+*/
+
+#include "Test.h"
+#include <cstring>
+
+using namespace Mona;
+using namespace std;
+
+int main(int argc, const char* argv[]) {
+	UInt32 count = 0;
+	for (auto& test : Test::Tests()) {
+		if (argc > 1 && strcmp(argv[1], test.first) != 0)
+			continue;
+		UInt32 failures = Test::Failures();
+		test.second();
+		++count;
+		printf("%s %s\n", Test::Failures() == failures ? "OK  " : "FAIL", test.first);
+	}
+	printf("%u tests, %u failed checks\n", count, Test::Failures());
+	return Test::Failures() ? 1 : 0;
+}